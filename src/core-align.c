@@ -0,0 +1,417 @@
+#include <libklsmpte2064/klsmpte2064.h>
+
+#include "core-private.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+/* Timestamp driven A/V alignment.
+ *
+ * The regular push/pack calls assume the caller interleaves one video push,
+ * one audio push (per type) and one pack, per frame. The _pts variants below
+ * remove that requirement. Each push snapshots its fingerprint into a small
+ * ring of frames, ordered by PTS, audio and video for the same frame are
+ * paired when their PTS are within half a frame of each other.
+ * A frame becomes ready when its video fingerprint and every audio type
+ * previously seen on the context have arrived.
+ *
+ * Audio and video may be pushed from different threads, the ring is the
+ * only state they share and its lock is held only to copy a few bytes.
+ * klsmpte2064_encapsulation_pack_pts() must be called from a single thread.
+ */
+
+/* Used until we've seen two video frames or learned the timebase from audio. */
+#define ALIGN_DEFAULT_FRAME_DURATION 1500 /* 90KHz ticks, 60fps */
+
+void klsmpte2064_align_init(struct ctx_s *ctx)
+{
+	pthread_mutex_init(&ctx->align_mutex, NULL);
+	ctx->align_count = 0;
+	ctx->align_audio_mask = 0;
+	ctx->align_last_video_pts = -1;
+	ctx->align_frame_duration = 0;
+	ctx->align_audio_duration = 0;
+}
+
+void klsmpte2064_align_free(struct ctx_s *ctx)
+{
+	pthread_mutex_destroy(&ctx->align_mutex);
+}
+
+/* Caller holds align_mutex */
+static int64_t _align_tolerance(struct ctx_s *ctx)
+{
+	if (ctx->align_frame_duration) {
+		return ctx->align_frame_duration / 2;
+	}
+	if (ctx->align_audio_duration) {
+		return ctx->align_audio_duration / 2;
+	}
+	return ALIGN_DEFAULT_FRAME_DURATION / 2;
+}
+
+/* Find the frame for a pts, or insert a new empty one in pts order.
+ * When the ring is full the oldest frame is discarded, the caller
+ * isn't draining containers fast enough.
+ * Caller holds align_mutex.
+ */
+static struct fp_frame_s *_align_find_or_insert(struct ctx_s *ctx, int64_t pts)
+{
+	int64_t tolerance = _align_tolerance(ctx);
+
+	for (int i = 0; i < ctx->align_count; i++) {
+		int64_t d = ctx->align_frames[i].pts - pts;
+		if (d < 0) {
+			d = -d;
+		}
+		if (d < tolerance) {
+			return &ctx->align_frames[i];
+		}
+	}
+
+	if (ctx->align_count == ALIGN_MAX_FRAMES) {
+		if (klsmpte2064_verbose(ctx)) {
+			printf(MODULE_PREFIX "alignment buffer full, discarding frame pts %" PRIi64 "\n",
+				ctx->align_frames[0].pts);
+		}
+		memmove(&ctx->align_frames[0], &ctx->align_frames[1], sizeof(struct fp_frame_s) * (ALIGN_MAX_FRAMES - 1));
+		ctx->align_count--;
+	}
+
+	int pos = ctx->align_count;
+	while (pos > 0 && ctx->align_frames[pos - 1].pts > pts) {
+		pos--;
+	}
+	memmove(&ctx->align_frames[pos + 1], &ctx->align_frames[pos], sizeof(struct fp_frame_s) * (ctx->align_count - pos));
+	ctx->align_count++;
+
+	struct fp_frame_s *f = &ctx->align_frames[pos];
+	memset(f, 0, sizeof(*f));
+	f->pts = pts;
+
+	return f;
+}
+
+int klsmpte2064_video_push_pts(void *hdl, const uint8_t *lumaplane, int64_t pts)
+{
+	struct ctx_s *ctx = (struct ctx_s *)hdl;
+	if (!ctx) {
+		return -EINVAL;
+	}
+
+	/* Frames dropped upstream show up as a PTS gap, a PTS moving backwards
+	 * is a source switch. Either way the motion history no longer applies.
+	 * Only this thread writes the last pts and the duration.
+	 */
+	int gap = 0;
+	if (ctx->align_last_video_pts >= 0 && ctx->align_frame_duration) {
+		int64_t d = pts - ctx->align_last_video_pts;
+		if (d <= 0 || d > ctx->align_frame_duration + (ctx->align_frame_duration / 2)) {
+			gap = 1;
+			klsmpte2064_video_signal_discontinuity(hdl);
+		}
+	}
+
+	int r = klsmpte2064_video_push(hdl, lumaplane);
+	if (r < 0) {
+		return r;
+	}
+
+	pthread_mutex_lock(&ctx->align_mutex);
+
+	/* Learn the frame duration from the video cadence */
+	if (ctx->align_last_video_pts >= 0 && !gap) {
+		int64_t d = pts - ctx->align_last_video_pts;
+		if (d > 0 && d < 90000) {
+			ctx->align_frame_duration = d;
+		}
+	}
+	ctx->align_last_video_pts = pts;
+
+	/* Video fingerprints are only valid once we have enough history, see 5.2.3.1.
+	 * Discontinuity frames are kept so their container can be marked.
+	 */
+	if (ctx->fingerprints_calculated >= 3 || ctx->video_flags) {
+		struct fp_frame_s *f = _align_find_or_insert(ctx, pts);
+		klsmpte2064_frame_capture_video(ctx, f);
+		f->pts = pts; /* Video pts is authoritative for the container */
+	}
+
+	pthread_mutex_unlock(&ctx->align_mutex);
+
+	return 0;
+}
+
+int klsmpte2064_audio_push_pts(void *hdl, enum klsmpte2064_audio_type_e type,
+	uint32_t timebase_num, uint32_t timebase_den,
+	const int16_t *planes[], uint32_t planeCount, uint32_t sampleCount, int64_t pts)
+{
+	struct ctx_s *ctx = (struct ctx_s *)hdl;
+
+	int r = klsmpte2064_audio_push(hdl, type, timebase_num, timebase_den, planes, planeCount, sampleCount);
+	if (r < 0) {
+		return r;
+	}
+
+	/* t3 belongs to this thread, the video thread sees its frame duration via the ring lock */
+	int64_t duration = ((int64_t)90000 * ctx->t3->timebase_num) / ctx->t3->timebase_den;
+
+	pthread_mutex_lock(&ctx->align_mutex);
+
+	ctx->align_audio_mask |= (1 << type);
+	ctx->align_audio_duration = duration;
+
+	struct fp_frame_s *f = _align_find_or_insert(ctx, pts);
+	klsmpte2064_frame_capture_audio(ctx, type, f);
+
+	pthread_mutex_unlock(&ctx->align_mutex);
+
+	return 0;
+}
+
+/* Remove the oldest frame from the ring if it's ready for encapsulation.
+ * Frames that never received video are discarded once a newer frame has video.
+ * Frames with video but missing audio are released once the ring is half full,
+ * the audio is considered lost.
+ * Caller holds align_mutex.
+ */
+static int _align_has_video(const struct fp_frame_s *f)
+{
+	return f->video_ready || (f->flags & KLSMPTE2064_CONTAINER_DISCONTINUITY);
+}
+
+static int _align_pop(struct ctx_s *ctx, struct fp_frame_s *out)
+{
+	while (ctx->align_count) {
+		struct fp_frame_s *f = &ctx->align_frames[0];
+
+		if (!_align_has_video(f)) {
+			int newer_video = 0;
+			for (int i = 1; i < ctx->align_count; i++) {
+				if (_align_has_video(&ctx->align_frames[i])) {
+					newer_video = 1;
+					break;
+				}
+			}
+			if (!newer_video) {
+				return -ENODATA;
+			}
+		} else {
+			int complete = (f->audio_mask & ctx->align_audio_mask) == ctx->align_audio_mask;
+			if (!complete && ctx->align_count <= (ALIGN_MAX_FRAMES / 2)) {
+				return -ENODATA;
+			}
+			*out = *f;
+		}
+
+		int emit = _align_has_video(f);
+		memmove(&ctx->align_frames[0], &ctx->align_frames[1], sizeof(struct fp_frame_s) * (ctx->align_count - 1));
+		ctx->align_count--;
+
+		if (emit) {
+			return 0;
+		}
+	}
+
+	return -ENODATA;
+}
+
+int klsmpte2064_encapsulation_pack_pts(void *hdl, uint8_t *data, uint32_t len, uint32_t *usedLength, int64_t *pts)
+{
+	struct ctx_s *ctx = (struct ctx_s *)hdl;
+	if (!ctx || !data || len < 256 || !usedLength) {
+		return -EINVAL;
+	}
+
+	struct fp_frame_s f;
+
+	pthread_mutex_lock(&ctx->align_mutex);
+	int r = _align_pop(ctx, &f);
+	pthread_mutex_unlock(&ctx->align_mutex);
+	if (r < 0) {
+		return r;
+	}
+
+	if (pts) {
+		*pts = f.pts;
+	}
+
+	return klsmpte2064_encapsulation_pack_frame(ctx, &f, data, len, usedLength);
+}
+
+/* Push based emission, see klsmpte2064_encapsulation_set_emit().
+ *
+ * A container goes out from the video push thread as soon as a frame's
+ * video fingerprint is computed, with the audio published since the
+ * previous container. Audio slots seen before but missing are flagged
+ * KLSMPTE2064_CONTAINER_AUDIO_ABSENT and remembered against the frame.
+ * When a slot's fingerprint is published it goes out from the audio push
+ * thread as a follow up for the oldest frame still missing it,
+ * KLSMPTE2064_CONTAINER_LATE_AUDIO with no video.
+ *
+ * Each slot's audio arrives in order, so frames are owed audio oldest first.
+ * Only the last EMIT_WINDOW containers are remembered, audio owed to one
+ * that has left the window is dropped when it arrives.
+ *
+ * Both threads decide under align_mutex, and emit under it, so containers
+ * reach the callback in sequence counter order.
+ */
+
+/* Copy the published fingerprints of the slots in mask */
+static void _emit_capture_audio(struct ctx_s *ctx, uint32_t mask, struct fp_frame_s *f)
+{
+	uint32_t seq;
+
+	do {
+		seq = seqlock_read_begin(&ctx->audio_pub_seq);
+		for (int i = 0; i < AFP_SLOTS; i++) {
+			if (mask & (1 << i)) {
+				f->afp_len[i] = ctx->audio_pub.afp_len[i];
+				f->afp_mixtype[i] = ctx->audio_pub.afp_mixtype[i];
+				memcpy(&f->afp[i][0], &ctx->audio_pub.afp[i][0], sizeof(f->afp[i]));
+			}
+		}
+	} while (seqlock_read_retry(&ctx->audio_pub_seq, seq));
+
+	f->audio_mask = mask;
+}
+
+/* Caller holds align_mutex */
+static void _emit(struct ctx_s *ctx, const struct fp_frame_s *f, uint64_t frame)
+{
+	uint8_t data[256];
+	uint32_t len = 0;
+
+	if (klsmpte2064_encapsulation_pack_frame(ctx, f, data, sizeof(data), &len) == 0) {
+		ctx->emit(ctx->emit_opaque, ctx, data, len, frame, f->flags);
+	}
+}
+
+/* Called by the video push thread once a frame is published */
+void klsmpte2064_emit_video(struct ctx_s *ctx)
+{
+	struct fp_frame_s f;
+	memset(&f, 0, sizeof(f));
+	klsmpte2064_frame_capture_video(ctx, &f);
+
+	pthread_mutex_lock(&ctx->align_mutex);
+
+	uint32_t fresh = ctx->emit_fresh;
+	ctx->emit_fresh = 0;
+	_emit_capture_audio(ctx, fresh, &f);
+
+	uint64_t frame = ctx->emit_frame++;
+	uint32_t absent = ctx->emit_seen & ~fresh;
+	if (absent) {
+		f.flags |= KLSMPTE2064_CONTAINER_AUDIO_ABSENT;
+	}
+
+	/* The frame this replaces leaves the window, audio it's still owed will be dropped */
+	uint32_t expired = ctx->emit_absent[frame % EMIT_WINDOW];
+	for (int i = 0; expired; i++, expired >>= 1) {
+		ctx->emit_expired[i] += expired & 1;
+	}
+	ctx->emit_absent[frame % EMIT_WINDOW] = absent;
+
+	_emit(ctx, &f, frame);
+
+	pthread_mutex_unlock(&ctx->align_mutex);
+}
+
+/* Called by the audio push thread once fingerprints are published */
+void klsmpte2064_emit_audio(struct ctx_s *ctx, uint32_t slotMask)
+{
+	/* Slots published empty, Eg. programs being retired, aren't expected */
+	slotMask &= ctx->audio_pub.audio_mask;
+	if (!slotMask) {
+		return;
+	}
+
+	pthread_mutex_lock(&ctx->align_mutex);
+
+	ctx->emit_seen |= slotMask;
+
+	/* Match each slot to the oldest frame still owed it */
+	uint32_t late[EMIT_WINDOW] = { 0 };
+	uint32_t matched = 0;
+	for (int i = 0; i < AFP_SLOTS; i++) {
+		uint32_t bit = 1 << i;
+		if (!(slotMask & bit)) {
+			continue;
+		}
+		if (ctx->emit_expired[i]) {
+			ctx->emit_expired[i]--;
+			matched |= bit; /* Its frame has gone, drop it */
+			continue;
+		}
+		uint64_t oldest = ctx->emit_frame < EMIT_WINDOW ? 0 : ctx->emit_frame - EMIT_WINDOW;
+		for (uint64_t frame = oldest; frame < ctx->emit_frame; frame++) {
+			int idx = frame % EMIT_WINDOW;
+			if (ctx->emit_absent[idx] & bit) {
+				ctx->emit_absent[idx] &= ~bit;
+				late[idx] |= bit;
+				matched |= bit;
+				break;
+			}
+		}
+	}
+	ctx->emit_fresh |= slotMask & ~matched;
+
+	/* One follow up per frame, oldest first */
+	if (matched) {
+		uint64_t oldest = ctx->emit_frame < EMIT_WINDOW ? 0 : ctx->emit_frame - EMIT_WINDOW;
+		for (uint64_t frame = oldest; frame < ctx->emit_frame; frame++) {
+			int idx = frame % EMIT_WINDOW;
+			if (!late[idx]) {
+				continue;
+			}
+			struct fp_frame_s f;
+			memset(&f, 0, sizeof(f));
+			_emit_capture_audio(ctx, late[idx], &f);
+			f.flags = KLSMPTE2064_CONTAINER_LATE_AUDIO;
+
+			_emit(ctx, &f, frame);
+		}
+	}
+
+	pthread_mutex_unlock(&ctx->align_mutex);
+}
+
+/* Audio slots no longer pushed, Eg. retired programs. Caller holds align_mutex. */
+void klsmpte2064_emit_retire(struct ctx_s *ctx, uint32_t slotMask)
+{
+	ctx->emit_seen &= ~slotMask;
+	ctx->emit_fresh &= ~slotMask;
+	for (int i = 0; i < EMIT_WINDOW; i++) {
+		ctx->emit_absent[i] &= ~slotMask;
+	}
+	for (int i = 0; i < AFP_SLOTS; i++) {
+		if (slotMask & (1 << i)) {
+			ctx->emit_expired[i] = 0;
+		}
+	}
+}
+
+int klsmpte2064_encapsulation_set_emit(void *hdl,
+	void (*emit)(void *opaque, void *hdl, const uint8_t *data, uint32_t len, uint64_t frame, uint32_t flags),
+	void *opaque)
+{
+	struct ctx_s *ctx = (struct ctx_s *)hdl;
+	if (!ctx) {
+		return -EINVAL;
+	}
+
+	pthread_mutex_lock(&ctx->align_mutex);
+	ctx->emit = emit;
+	ctx->emit_opaque = opaque;
+	ctx->emit_seen = 0;
+	ctx->emit_fresh = 0;
+	ctx->emit_frame = 0;
+	memset(&ctx->emit_absent[0], 0, sizeof(ctx->emit_absent));
+	memset(&ctx->emit_expired[0], 0, sizeof(ctx->emit_expired));
+	pthread_mutex_unlock(&ctx->align_mutex);
+
+	return 0;
+}
@@ -0,0 +1,141 @@
+#include <libklsmpte2064/klsmpte2064.h>
+
+#include "core-private.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Video analytics, freeze / black / scene cut detection.
+ *
+ * Everything is measured on the 16x60 grid windowed in 5.2.2, it's already
+ * in cache after the motion count, so the metrics cost one pass over 960
+ * bytes per frame rather than a read of the whole picture. The grid is the
+ * prefiltered luma, a freeze compares exactly, only noise in the source
+ * breaks it.
+ *
+ * The previous frame is wss_f3 for progressive video. Interlaced frames
+ * finish on the second field, wss_f3 is then the first field of the same
+ * frame and wss_f2 the second field of the previous one.
+ */
+
+#define ANALYTICS_FREEZE_DIFFERENCE 0.5
+#define ANALYTICS_BLACK_LEVEL       32
+#define ANALYTICS_BLACK_RATIO       0.98
+#define ANALYTICS_SCENE_DIFFERENCE  30.0
+
+#define ANALYTICS_STATE_FLAGS (KLSMPTE2064_VIDEO_ANALYTICS_FROZEN | KLSMPTE2064_VIDEO_ANALYTICS_BLACK)
+
+void klsmpte2064_video_analytics_frame(struct ctx_s *ctx)
+{
+	const struct klsmpte2064_video_analytics_params_s *p = &ctx->analytics_params;
+	struct klsmpte2064_video_analytics_s *a = &ctx->analytics;
+	const uint8_t *cur = &ctx->wss_f4[0][0];
+	const uint8_t *prv = ctx->progressive ? &ctx->wss_f3[0][0] : &ctx->wss_f2[0][0];
+
+	/* One pass, integer sums over the contiguous grid */
+	uint32_t sum = 0, sumsq = 0, black = 0, sad = 0;
+	for (int i = 0; i < WSS_SAMPLES_PER_FRAME; i++) {
+		uint32_t v = cur[i];
+		sum += v;
+		sumsq += v * v;
+		black += v <= p->blackLevel;
+		sad += abs((int)v - (int)prv[i]);
+	}
+
+	double prev_difference = a->difference;
+	uint32_t prev_flags = a->flags;
+
+	/* The first frame has no history, a reseeded frame compares against itself */
+	int history = a->frame > 0 && !(ctx->video_flags & KLSMPTE2064_CONTAINER_DISCONTINUITY);
+
+	a->frame++;
+	a->meanLuma = (double)sum / WSS_SAMPLES_PER_FRAME;
+	a->variance = ((double)sumsq / WSS_SAMPLES_PER_FRAME) - (a->meanLuma * a->meanLuma);
+	a->motion = ctx->motion;
+	a->difference = (double)sad / WSS_SAMPLES_PER_FRAME;
+	a->flags = 0;
+
+	if (history && a->difference <= p->freezeDifference) {
+		a->flags |= KLSMPTE2064_VIDEO_ANALYTICS_FROZEN;
+	}
+	if (black >= p->blackRatio * WSS_SAMPLES_PER_FRAME) {
+		a->flags |= KLSMPTE2064_VIDEO_ANALYTICS_BLACK;
+	}
+	/* Rising edge only, a sustained pan stays above the threshold */
+	if (history && a->difference >= p->sceneCutDifference && prev_difference < p->sceneCutDifference) {
+		a->flags |= KLSMPTE2064_VIDEO_ANALYTICS_SCENE_CUT;
+	}
+
+	a->freezeFrames = (a->flags & KLSMPTE2064_VIDEO_ANALYTICS_FROZEN) ? a->freezeFrames + 1 : 0;
+	a->blackFrames = (a->flags & KLSMPTE2064_VIDEO_ANALYTICS_BLACK) ? a->blackFrames + 1 : 0;
+
+	seqlock_write_begin(&ctx->analytics_pub_seq);
+	ctx->analytics_pub = *a;
+	seqlock_write_end(&ctx->analytics_pub_seq);
+
+	uint32_t changed = ((a->flags ^ prev_flags) & ANALYTICS_STATE_FLAGS) | (a->flags & KLSMPTE2064_VIDEO_ANALYTICS_SCENE_CUT);
+	if (changed && p->stateChange) {
+		p->stateChange(p->opaque, ctx, a, changed);
+	}
+}
+
+int klsmpte2064_video_analytics_enable(void *hdl, const struct klsmpte2064_video_analytics_params_s *params)
+{
+	struct ctx_s *ctx = (struct ctx_s *)hdl;
+	if (!ctx) {
+		return -EINVAL;
+	}
+
+	ctx->analytics_enabled = 0;
+	memset(&ctx->analytics, 0, sizeof(ctx->analytics));
+	seqlock_write_begin(&ctx->analytics_pub_seq);
+	memset(&ctx->analytics_pub, 0, sizeof(ctx->analytics_pub));
+	seqlock_write_end(&ctx->analytics_pub_seq);
+
+	if (!params) {
+		return 0;
+	}
+	if (params->freezeDifference < 0 || params->blackLevel > 255 ||
+		params->blackRatio < 0 || params->blackRatio > 1.0 || params->sceneCutDifference < 0) {
+		return -EINVAL;
+	}
+
+	struct klsmpte2064_video_analytics_params_s *p = &ctx->analytics_params;
+	*p = *params;
+	if (p->freezeDifference == 0) {
+		p->freezeDifference = ANALYTICS_FREEZE_DIFFERENCE;
+	}
+	if (p->blackLevel == 0) {
+		p->blackLevel = ANALYTICS_BLACK_LEVEL;
+	}
+	if (p->blackRatio == 0) {
+		p->blackRatio = ANALYTICS_BLACK_RATIO;
+	}
+	if (p->sceneCutDifference == 0) {
+		p->sceneCutDifference = ANALYTICS_SCENE_DIFFERENCE;
+	}
+	ctx->analytics_enabled = 1;
+
+	return 0;
+}
+
+int klsmpte2064_video_analytics_query(void *hdl, struct klsmpte2064_video_analytics_s *stats)
+{
+	struct ctx_s *ctx = (struct ctx_s *)hdl;
+	if (!ctx || !stats) {
+		return -EINVAL;
+	}
+
+	uint32_t seq;
+	do {
+		seq = seqlock_read_begin(&ctx->analytics_pub_seq);
+		*stats = ctx->analytics_pub;
+	} while (seqlock_read_retry(&ctx->analytics_pub_seq, seq));
+
+	if (stats->frame == 0) {
+		return -EAGAIN;
+	}
+
+	return 0;
+}
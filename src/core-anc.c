@@ -0,0 +1,187 @@
+#include <libklsmpte2064/klsmpte2064.h>
+
+#include "core-private.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* SMPTE 291 ancillary data packets, see core-anc.h.
+ *
+ * Type 2 packet, 10 bit words:
+ *  ADF 0x000 0x3ff 0x3ff | DID | SDID | DC | UDW x DC | CS
+ *
+ * DID, SDID, DC and the UDW carry 8 bits of data, b8 even parity over
+ * b0 - b7 and b9 the inverse of b8. CS is the sum of the 9 LSBs of every
+ * word from DID to the last UDW, b9 the inverse of its b8.
+ *
+ * In HD VANC the packets ride the luma samples. V210 packs 6 pixels into
+ * four 32 bit words, the luma samples sit at:
+ *  Y0 w0[19:10], Y1 w1[9:0], Y2 w1[29:20], Y3 w2[19:10], Y4 w3[9:0], Y5 w3[29:20]
+ */
+
+#define ANC_ADF_WORDS 3
+
+static const uint8_t _v210_luma_word[6] = { 0, 1, 1, 2, 3, 3 };
+static const uint8_t _v210_luma_shift[6] = { 10, 0, 20, 10, 0, 20 };
+
+static inline uint16_t _anc_word(uint8_t v)
+{
+	return v | (__builtin_parity(v) ? 0x100 : 0x200);
+}
+
+static inline int _anc_word_valid(uint16_t w)
+{
+	return _anc_word(w & 0xff) == w;
+}
+
+static inline void _v210_set_luma(uint32_t *line, uint32_t i, uint16_t v)
+{
+	uint32_t *w = &line[((i / 6) * 4) + _v210_luma_word[i % 6]];
+	uint32_t shift = _v210_luma_shift[i % 6];
+
+	*w = (*w & ~(0x3ffU << shift)) | ((uint32_t)v << shift);
+}
+
+/* Produce the packet words in order, into words[] or, when it's NULL, the
+ * luma samples of a V210 line. Inlined into each caller, the sink is fixed.
+ */
+static inline __attribute__((always_inline)) void _anc_generate(uint8_t did, uint8_t sdid,
+	const uint8_t *data, uint32_t len, uint16_t *words, uint32_t *line, uint32_t offset)
+{
+#define ANC_PUT(i, v) do { if (words) { words[i] = (v); } else { _v210_set_luma(line, offset + (i), (v)); } } while (0)
+	uint32_t n = 0;
+
+	ANC_PUT(n, 0x000); n++;
+	ANC_PUT(n, 0x3ff); n++;
+	ANC_PUT(n, 0x3ff); n++;
+
+	uint16_t w = _anc_word(did);
+	uint32_t sum = w;
+	ANC_PUT(n, w); n++;
+	w = _anc_word(sdid);
+	sum += w;
+	ANC_PUT(n, w); n++;
+	w = _anc_word(len);
+	sum += w;
+	ANC_PUT(n, w); n++;
+
+	for (uint32_t i = 0; i < len; i++) {
+		w = _anc_word(data[i]);
+		sum += w;
+		ANC_PUT(n, w); n++;
+	}
+
+	sum &= 0x1ff;
+	ANC_PUT(n, sum | ((~sum & 0x100) << 1));
+#undef ANC_PUT
+}
+
+int klsmpte2064_anc_build(uint8_t did, uint8_t sdid, const uint8_t *data, uint32_t len, uint16_t *words, uint32_t wordCount)
+{
+	if (!data || !words || len == 0 || len > 255) {
+		return -EINVAL;
+	}
+	if (wordCount < KLSMPTE2064_ANC_WORDS(len)) {
+		return -ENOSPC;
+	}
+
+	_anc_generate(did, sdid, data, len, words, NULL, 0);
+
+	return KLSMPTE2064_ANC_WORDS(len);
+}
+
+int klsmpte2064_anc_pack_v210(uint8_t did, uint8_t sdid, const uint8_t *data, uint32_t len,
+	uint32_t *line, uint32_t width, uint32_t offset)
+{
+	if (!data || !line || len == 0 || len > 255) {
+		return -EINVAL;
+	}
+	if (offset > width || width - offset < KLSMPTE2064_ANC_WORDS(len)) {
+		return -ENOSPC;
+	}
+
+	_anc_generate(did, sdid, data, len, NULL, line, offset);
+
+	return KLSMPTE2064_ANC_WORDS(len);
+}
+
+int klsmpte2064_anc_parse(const uint16_t *words, uint32_t wordCount, uint8_t did, uint8_t sdid,
+	uint8_t *data, uint32_t len, uint32_t *usedLength)
+{
+	if (!words || !data || !usedLength) {
+		return -EINVAL;
+	}
+
+	/* The shortest packet is an ADF, DID, SDID, DC and CS */
+	uint32_t i = 0;
+	while (i + KLSMPTE2064_ANC_WORDS(0) <= wordCount) {
+		if (words[i] != 0x000 || words[i + 1] != 0x3ff || words[i + 2] != 0x3ff) {
+			i++;
+			continue;
+		}
+
+		const uint16_t *p = &words[i + ANC_ADF_WORDS];
+		if (!_anc_word_valid(p[2])) {
+			/* Not a packet, the DC can't be trusted to skip it */
+			i++;
+			continue;
+		}
+		uint32_t dc = p[2] & 0xff;
+		if (i + KLSMPTE2064_ANC_WORDS(dc) > wordCount) {
+			return -ENODATA; /* Truncated by the end of the line */
+		}
+		if ((p[0] & 0xff) != did || (p[1] & 0xff) != sdid) {
+			i += KLSMPTE2064_ANC_WORDS(dc);
+			continue;
+		}
+
+		uint32_t sum = 0;
+		int valid = _anc_word_valid(p[0]) && _anc_word_valid(p[1]);
+		for (uint32_t k = 0; k < dc + 3; k++) {
+			sum += p[k] & 0x1ff;
+		}
+		for (uint32_t k = 0; k < dc; k++) {
+			valid &= _anc_word_valid(p[3 + k]);
+		}
+		sum &= 0x1ff;
+		if (!valid || p[3 + dc] != (sum | ((~sum & 0x100) << 1))) {
+			return -EBADMSG;
+		}
+		if (dc > len) {
+			return -ENOSPC;
+		}
+
+		for (uint32_t k = 0; k < dc; k++) {
+			data[k] = p[3 + k];
+		}
+		*usedLength = dc;
+
+		return 0;
+	}
+
+	return -ENODATA;
+}
+
+int klsmpte2064_anc_parse_v210(const uint32_t *line, uint32_t width, uint8_t did, uint8_t sdid,
+	uint8_t *data, uint32_t len, uint32_t *usedLength)
+{
+	if (!line || width > KLSMPTE2064_ANC_V210_WIDTH_MAX) {
+		return -EINVAL;
+	}
+
+	/* Unpack the luma, V210 lines hold whole groups of 6 pixels, then scan it as words */
+	uint16_t y[KLSMPTE2064_ANC_V210_WIDTH_MAX + 5];
+	const uint32_t *src = line;
+	for (uint32_t i = 0; i < width; i += 6) {
+		y[i + 0] = (src[0] >> 10) & 0x3ff;
+		y[i + 1] = src[1] & 0x3ff;
+		y[i + 2] = (src[1] >> 20) & 0x3ff;
+		y[i + 3] = (src[2] >> 10) & 0x3ff;
+		y[i + 4] = src[3] & 0x3ff;
+		y[i + 5] = (src[3] >> 20) & 0x3ff;
+		src += 4;
+	}
+
+	return klsmpte2064_anc_parse(y, width, did, sdid, data, len, usedLength);
+}
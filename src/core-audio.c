@@ -54,18 +54,18 @@
 #define ORIGINAL_SPEC_IMPLEMENTATION 0
 
 struct tbl3_s tbl3[] = {
-	{ 23.98, 52, { 77, 16 }, 923, 1001, 24000, },
-	{ 29.97, 52, { 77, 20 }, 923, 1001, 30000, },
+	{ 23.98, 52, { 77, 16 }, 923, 1001, 24000, FRAMERATE_23_976, },
+	{ 29.97, 52, { 77, 20 }, 923, 1001, 30000, FRAMERATE_29_97, },
 #if 0
 	/* No support for 48 / 1.001 */
 	{ 47.95, 52, { 77, 32 }, 923, },
 #endif
-	{ 59.94, 52, { 77, 40 }, 923, 1001, 60000, },
-	{    24, 50, { 80, 16 }, 960,    1,    24, },
-	{    25, 50, { 96, 20 }, 960,    1,    25, },
-	{    30, 50, { 80, 20 }, 960,    1,    30, },
-	{    50, 50, { 96, 40 }, 960,    1,    50, },
-	{    60, 50, { 80, 40 }, 960,    1,    60, },
+	{ 59.94, 52, { 77, 40 }, 923, 1001, 60000, FRAMERATE_59_94, },
+	{    24, 50, { 80, 16 }, 960,    1,    24, FRAMERATE_24, },
+	{    25, 50, { 96, 20 }, 960,    1,    25, FRAMERATE_25, },
+	{    30, 50, { 80, 20 }, 960,    1,    30, FRAMERATE_30, },
+	{    50, 50, { 96, 40 }, 960,    1,    50, FRAMERATE_50, },
+	{    60, 50, { 80, 40 }, 960,    1,    60, FRAMERATE_60, },
 };
 
 const struct tbl3_s *lookupTable3(double video_frame_rate)
@@ -79,6 +79,17 @@ const struct tbl3_s *lookupTable3(double video_frame_rate)
 	return NULL; /* Failed */
 }
 
+const struct tbl3_s *lookupTable3PictureRate(enum klsmpte2064_frame_rate_e rate)
+{
+	for (int i = 0; i < (sizeof(tbl3) / sizeof(struct tbl3_s)); i++) {
+		struct tbl3_s *t = &tbl3[i];
+		if (rate == t->picture_rate) {
+			return t;
+		}
+	}
+	return NULL; /* Failed */
+}
+
 const struct tbl3_s *lookupTable3Timebase(uint32_t num, uint32_t den)
 {
 	for (int i = 0; i < (sizeof(tbl3) / sizeof(struct tbl3_s)); i++) {
@@ -95,24 +106,43 @@ static inline float pcm16_to_float(int16_t sample)
     return sample >= 0 ? (float)sample / 32767.0f : (float)sample / 32768.0f;
 }
 
-/* 5.3.6 - Decimator - on one mono buffer */
-static void _audio_decimator(struct ctx_s *ctx, enum klsmpte2064_audio_type_e type, uint32_t sampleCount, uint8_t *comp_bit, uint8_t *result)
+/* The detector coefficients below are per sample and were tuned at 48KHz.
+ * Rescale a coefficient so its time constant is unchanged at the analysis rate.
+ */
+static float _audio_rate_coefficient(struct ctx_s *ctx, float k)
+{
+	if (ctx->sample_rate == AUDIO_SAMPLE_RATE * ctx->decimate) {
+		return k;
+	}
+	return 1.0f - powf(1.0f - k, ((float)AUDIO_SAMPLE_RATE * ctx->decimate) / ctx->sample_rate);
+}
+
+/* 5.3.6 - Decimator - on one mono buffer, comp_bit[i * stride] is sample i */
+static void _audio_decimator(struct ctx_s *ctx, int slot, uint32_t sampleCount, const uint8_t *comp_bit, uint32_t stride, uint8_t *result)
 {
 	/* remove any prev fp */
-	memset(&ctx->fp_buffer[type][0], 0, sizeof(ctx->fp_buffer[type]));
-	klbs_init(&ctx->fp_bs[type]);
-	klbs_write_set_buffer(&ctx->fp_bs[type], &ctx->fp_buffer[type][0], sizeof(ctx->fp_buffer[type]));
+	memset(&ctx->fp_buffer[slot][0], 0, sizeof(ctx->fp_buffer[slot]));
+	klbs_init(&ctx->fp_bs[slot]);
+	klbs_write_set_buffer(&ctx->fp_bs[slot], &ctx->fp_buffer[slot][0], sizeof(ctx->fp_buffer[slot]));
 
 	memset(result, 0, sampleCount);
 
-	/* decimate envelope/mean comparison */
-	for (uint32_t i = 0; i < sampleCount; i += ctx->t3->decimator_factor) {
-		result[i / ctx->t3->decimator_factor] = comp_bit[i];
-		klbs_write_bit(&ctx->fp_bs[type], comp_bit[i]);
-//		printf("%3d: bit %3d: = %d\n", i, i / ctx->t3->decimator_factor, comp_bit[i]);
+	/* decimate envelope/mean comparison. Table 3 factors are in 48KHz samples,
+	 * keep the same bits per second at other analysis rates, Eg. 52 becomes 47.775 at 44.1KHz.
+	 */
+	uint64_t step_num = (uint64_t)ctx->t3->decimator_factor * ctx->sample_rate;
+	uint64_t step_den = (uint64_t)AUDIO_SAMPLE_RATE * ctx->decimate;
+	for (uint32_t k = 0; ; k++) {
+		uint32_t i = (k * step_num) / step_den;
+		if (i >= sampleCount) {
+			break;
+		}
+		result[k] = comp_bit[i * stride];
+		klbs_write_bit(&ctx->fp_bs[slot], comp_bit[i * stride]);
+//		printf("%3d: bit %3d: = %d\n", i, k, comp_bit[i]);
 	}
-	klbs_write_buffer_complete(&ctx->fp_bs[type]);
-	//printf("fp bytes used %d\n", klbs_get_byte_count(&ctx->fp_bs[type]));
+	klbs_write_buffer_complete(&ctx->fp_bs[slot]);
+	//printf("fp bytes used %d\n", klbs_get_byte_count(&ctx->fp_bs[slot]));
 }
 
 /* 5.3.5 - Envelope/Mean Comparator - on two mono buffers */
@@ -164,7 +194,7 @@ static void _audio_local_mean_detector(struct ctx_s *ctx, uint32_t sampleCount,
 	}
 #else
 	/* is the IIR filter coefficient (decay factor). A large Km causes slower decay and thus a longer memory window. */
-	const float beta = 0.005f;
+	const float beta = _audio_rate_coefficient(ctx, 0.005f);
 
 	/* Ms[] is the local mean of the signal over time, with smoothing controlled by Km. */
 	Ms[0] = a_wav[0];
@@ -226,7 +256,7 @@ static void _audio_envelope_detector(struct ctx_s *ctx, uint32_t sampleCount, fl
 	 *   Each new value of Es[i] is 25% from the current input and 75% from the past.
 	 *   The envelope will rise quickly with loud input, then decay gently when input drops.
 	 */
-	const float alpha = 0.25f; /* How quickly the solution adapts to energy change */
+	const float alpha = _audio_rate_coefficient(ctx, 0.25f); /* How quickly the solution adapts to energy change */
 
 	Es[0] = a_wav[0];
 
@@ -237,11 +267,180 @@ static void _audio_envelope_detector(struct ctx_s *ctx, uint32_t sampleCount, fl
 #endif
 }
 
-/* 5.3.2 - Pseudo Absolute Value - on a mono buffer */
-static void _audio_pseudo_abs_value(struct ctx_s *ctx, uint32_t sampleCount, float *a_wav)
+#define AUDIO_LEVEL_LANES 8
+
+/* 5.3.2 - Pseudo Absolute Value - on a mono buffer.
+ * The level metrics of the slot come for free while the samples are rectified,
+ * the peak and sum are kept in AUDIO_LEVEL_LANES partial lanes so the loop
+ * still vectorises. Non negative floats order the same as their bit patterns,
+ * the peak is an integer max, which vectorises where a float compare won't.
+ */
+static void _audio_pseudo_abs_value(struct ctx_s *ctx, int slot, uint32_t sampleCount, float *a_wav)
 {
+	uint32_t peak[AUDIO_LEVEL_LANES] = { 0 };
+	float sum[AUDIO_LEVEL_LANES] = { 0 };
+	uint32_t blocks = sampleCount / AUDIO_LEVEL_LANES;
+	uint32_t bits;
+
+	for (uint32_t b = 0; b < blocks; b++) {
+		float *x = a_wav + (b * AUDIO_LEVEL_LANES);
+		for (int l = 0; l < AUDIO_LEVEL_LANES; l++) {
+			float a = fabsf(x[l]);
+			x[l] = a;
+			memcpy(&bits, &a, sizeof(bits));
+			peak[l] = bits > peak[l] ? bits : peak[l];
+			sum[l] += a;
+		}
+	}
+	for (uint32_t i = blocks * AUDIO_LEVEL_LANES; i < sampleCount; i++) {
+		float a = fabsf(a_wav[i]);
+		a_wav[i] = a;
+		memcpy(&bits, &a, sizeof(bits));
+		peak[0] = bits > peak[0] ? bits : peak[0];
+		sum[0] += a;
+	}
+	for (int l = 1; l < AUDIO_LEVEL_LANES; l++) {
+		peak[0] = peak[l] > peak[0] ? peak[l] : peak[0];
+		sum[0] += sum[l];
+	}
+
+	struct klsmpte2064_audio_levels_s *lv = &ctx->levels[slot];
+	lv->frames++;
+	memcpy(&lv->peak, &peak[0], sizeof(lv->peak));
+	lv->mean = sampleCount ? sum[0] / sampleCount : 0;
+	lv->silenceFrames = lv->peak <= ctx->silence_level ? lv->silenceFrames + 1 : 0;
+	lv->clippedSamples = ctx->audio_clips[slot];
+	ctx->audio_clips[slot] = 0;
+}
+
+/* 1 for an input sample at full scale, either polarity. Branchless,
+ * -32768 and 32767 are the only values that land at or above 65534.
+ */
+static inline uint32_t _audio_clipped_s16(int32_t s)
+{
+	return (uint32_t)(s + 32767) >= 65534;
+}
+
+static uint32_t _audio_count_clipped_s16(const int16_t *s, uint32_t sampleCount)
+{
+	uint32_t n = 0;
 	for (uint32_t i = 0; i < sampleCount; i++) {
-		a_wav[i] = fabs(a_wav[i]);
+		n += _audio_clipped_s16(s[i]);
+	}
+	return n;
+}
+
+/* Fixed point detectors, AUDIO_PIPELINE_FIXED and AUDIO_PIPELINE_FIXED_SPEC.
+ * Steps 5.3.3 to 5.3.5 folded into one pass over the pseudo absolute samples,
+ * quantized to 15bit magnitudes. The tuned filters hold their state in Q30 with
+ * Q16 coefficients, one 32x32 -> 64 product per step can't overflow. The spec
+ * filters are the integer recursions as written, the state is never negative
+ * so floor(x / Km) is x >> log2(Km).
+ * Integer adds, multiplies and arithmetic shifts only, the comparator bits don't
+ * depend on the compiler, float contraction or the CPU.
+ */
+#define AUDIO_FIXED_DELTA   16106127 /* Comparator margin 0.015 in Q30 */
+#define AUDIO_SPEC_MS_SHIFT 13       /* 5.3.4 Km 8192 */
+#define AUDIO_SPEC_ES_SHIFT 8        /* 5.3.3 Ke 256 */
+#define AUDIO_SPEC_ES_GAIN  2        /* 5.3.3 Km / Ke, 1024 / 256 */
+
+/* Quantize a pseudo absolute sample to 0 .. 32767, the scale by 2^15 is exact */
+static inline int32_t _audio_fixed_sample(float x)
+{
+	int32_t q = (int32_t)((x * 32768.0f) + 0.5f);
+	return q > 32767 ? 32767 : q;
+}
+
+/* Tuned coefficients in Q30, 0.25 and 0.005 */
+#define AUDIO_FIXED_ALPHA 268435456
+#define AUDIO_FIXED_BETA  5368709
+
+/* 2^(2^-i) in Q30, i = 1 .. 30 */
+static const uint32_t _audio_exp2_q30[30] = {
+	1518500250, 1276901417, 1170923762, 1121280436, 1097253708,
+	1085434106, 1079572136, 1076653033, 1075196443, 1074468888,
+	1074105294, 1073923544, 1073832680, 1073787251, 1073764537,
+	1073753181, 1073747502, 1073744663, 1073743244, 1073742534,
+	1073742179, 1073742001, 1073741913, 1073741868, 1073741846,
+	1073741835, 1073741830, 1073741827, 1073741825, 1073741825,
+};
+
+/* log2(x) in Q30 for x in Q30, 0 < x < 2^31. One fraction bit per squaring. */
+static int64_t _audio_log2_q30(uint64_t x)
+{
+	int64_t r = 0;
+	while (x < (1ULL << 30)) {
+		x <<= 1;
+		r -= 1LL << 30;
+	}
+	for (int i = 1; i <= 30; i++) {
+		x = (x * x) >> 30;
+		if (x >= (2ULL << 30)) {
+			x >>= 1;
+			r += 1LL << (30 - i);
+		}
+	}
+	return r;
+}
+
+/* 2^y in Q30 for y <= 0 in Q30 */
+static uint64_t _audio_exp2_q30_neg(int64_t y)
+{
+	int64_t m = -(y >> 30); /* y = f - m, 0 <= f < 1 */
+	uint64_t f = y + (m << 30);
+	uint64_t r = 1ULL << 30;
+	for (int i = 1; i <= 30; i++) {
+		if (f & (1ULL << (30 - i))) {
+			r = (r * _audio_exp2_q30[i - 1]) >> 30;
+		}
+	}
+	return m >= 62 ? 0 : r >> m;
+}
+
+/* A tuned filter coefficient (Q30) as Q16, Eg. alpha 0.25 is 16384. As
+ * _audio_rate_coefficient(), 1 - (1 - k)^(48000 / rate), in integer
+ * arithmetic so the coefficients are the same on every libm at any rate.
+ */
+static int32_t _audio_fixed_coefficient(struct ctx_s *ctx, uint32_t k)
+{
+	uint64_t keep = (1ULL << 30) - k;
+	if (ctx->sample_rate != AUDIO_SAMPLE_RATE * ctx->decimate) {
+		int64_t y = (_audio_log2_q30(keep) * ((int64_t)AUDIO_SAMPLE_RATE * ctx->decimate)) / ctx->sample_rate;
+		keep = _audio_exp2_q30_neg(y);
+	}
+	return (int32_t)(((1ULL << 30) - keep + (1 << 13)) >> 14);
+}
+
+static void _audio_detect_fixed(struct ctx_s *ctx, uint32_t sampleCount, const float *a_wav, uint8_t *comp_bit)
+{
+	if (sampleCount == 0) {
+		return;
+	}
+
+	if (ctx->audio_pipeline == AUDIO_PIPELINE_FIXED_SPEC) {
+		int32_t Es = 0, Ms = 0;
+		comp_bit[0] = 0;
+
+		for (uint32_t i = 1; i < sampleCount; i++) {
+			int32_t a = _audio_fixed_sample(a_wav[i]);
+			Ms = a + Ms - (Ms >> AUDIO_SPEC_MS_SHIFT);
+			Es = (a << AUDIO_SPEC_ES_GAIN) + Es - (Es >> AUDIO_SPEC_ES_SHIFT);
+			comp_bit[i] = Ms < Es;
+		}
+		return;
+	}
+
+	const int32_t alpha = _audio_fixed_coefficient(ctx, AUDIO_FIXED_ALPHA);
+	const int32_t beta = _audio_fixed_coefficient(ctx, AUDIO_FIXED_BETA);
+	int32_t Es = _audio_fixed_sample(a_wav[0]) << 15;
+	int32_t Ms = Es;
+	comp_bit[0] = (Ms + AUDIO_FIXED_DELTA) < Es;
+
+	for (uint32_t i = 1; i < sampleCount; i++) {
+		int32_t x = _audio_fixed_sample(a_wav[i]) << 15;
+		Es += (int32_t)(((int64_t)(x - Es) * alpha) >> 16);
+		Ms += (int32_t)(((int64_t)(x - Ms) * beta) >> 16);
+		comp_bit[i] = (Ms + AUDIO_FIXED_DELTA) < Es;
 	}
 }
 
@@ -260,6 +459,10 @@ static int _audio_downmix_stereo(struct ctx_s *ctx,	const int16_t *planes[], uin
 		buf[i] = ((ls * 0.7071) + (rs * 0.7071)) / 2;
 	}
 
+	/* Separate passes over the planes vectorise, the mix above doesn't */
+	ctx->audio_clips[AUDIOTYPE_STEREO_S16P] += _audio_count_clipped_s16(lft, sampleCount) +
+		_audio_count_clipped_s16(rgt, sampleCount);
+
 #if 0
 	static FILE *fh = NULL;
 	if (fh == NULL) {
@@ -281,14 +484,19 @@ static int _audio_downmix_decklink_interleaved_stereo(struct ctx_s *ctx, const i
 	const int32_t *s = (const int32_t *)planes[0];
 	int audioInputChannels = 16;
 
+	uint32_t clips = 0;
+
 	for (uint32_t i = 0; i < sampleCount; i++) {
 
 		/* Stride is 16 samples in decklink */
 		float ls = pcm16_to_float(s[ (i * audioInputChannels) + 0] >> 16);
 		float rs = pcm16_to_float(s[ (i * audioInputChannels) + 1] >> 16);
+		clips += _audio_clipped_s16(s[ (i * audioInputChannels) + 0] >> 16) +
+			_audio_clipped_s16(s[ (i * audioInputChannels) + 1] >> 16);
 
 		buf[i] = ((ls * 0.7071) + (rs * 0.7071)) / 2;
 	}
+	ctx->audio_clips[AUDIOTYPE_STEREO_S32_CH16_DECKLINK] += clips;
 
 #if 0
 	static FILE *fh = NULL;
@@ -310,6 +518,7 @@ static int _audio_downmix_decklink_interleaved_smpte312(struct ctx_s *ctx, const
 	/* Take ch0(L) and ch1(R), ch2(C), ch3(lfe), ch4(LS), ch(RS) into the analyzers */
 	const int32_t *s = (const int32_t *)planes[0];
 	int audioInputChannels = 16;
+	uint32_t clips = 0;
 
 	for (uint32_t i = 0; i < sampleCount; i++) {
 
@@ -320,9 +529,15 @@ static int _audio_downmix_decklink_interleaved_smpte312(struct ctx_s *ctx, const
 		//float lfe = pcm16_to_float(s[ (i * audioInputChannels) + 3] >> 16); // Specifically not used
 		float ls  = pcm16_to_float(s[ (i * audioInputChannels) + 4] >> 16);
 		float rs  = pcm16_to_float(s[ (i * audioInputChannels) + 5] >> 16);
+		clips += _audio_clipped_s16(s[ (i * audioInputChannels) + 0] >> 16) +
+			_audio_clipped_s16(s[ (i * audioInputChannels) + 1] >> 16) +
+			_audio_clipped_s16(s[ (i * audioInputChannels) + 2] >> 16) +
+			_audio_clipped_s16(s[ (i * audioInputChannels) + 4] >> 16) +
+			_audio_clipped_s16(s[ (i * audioInputChannels) + 5] >> 16);
 
 		buf[i] = ((l * 0.7071) + (r * 0.7071) + (1.0 * c) + (0.5 * ls) + (0.5 * rs)) / 4;
 	}
+	ctx->audio_clips[AUDIOTYPE_SMPTE312_S32_CH16_DECKLINK] += clips;
 
 #if 0
 	static FILE *fh = NULL;
@@ -341,13 +556,6 @@ static int _audio_downmix_decklink_interleaved_smpte312(struct ctx_s *ctx, const
 static int _audio_downmix(struct ctx_s *ctx, enum klsmpte2064_audio_type_e type,
 	const int16_t *planes[], uint32_t planeCount, uint32_t sampleCount, float *buf)
 {
-	if (sampleCount > ctx->audioMaxSampleCount) {
-		klsmpte2064_audio_free(ctx);
-		ctx->audioMaxSampleCount = sampleCount;
-		if (klsmpte2064_audio_alloc(ctx) < 0) {
-			return -ENOMEM;
-		}
-	}
 	switch (type) {
 	case AUDIOTYPE_STEREO_S16P:
 		return _audio_downmix_stereo(ctx, planes, planeCount, sampleCount, buf);
@@ -360,61 +568,85 @@ static int _audio_downmix(struct ctx_s *ctx, enum klsmpte2064_audio_type_e type,
 	}
 }
 
-int klsmpte2064_audio_alloc(struct ctx_s *ctx)
+/* Point the working buffers at the audio scratch, growing it to hold at least
+ * sampleCount samples and every configured program. Called at the start of each
+ * push, the scratch may be shared and have been grown by another context.
+ */
+int klsmpte2064_audio_bind(struct ctx_s *ctx, uint32_t sampleCount)
 {
-	ctx->bufA = malloc(ctx->audioMaxSampleCount * sizeof(float));
-	if (!ctx->bufA) {
-		return -ENOMEM;
-	}
-	ctx->Es = malloc(ctx->audioMaxSampleCount * sizeof(float));
-	if (!ctx->Es) {
-		return -ENOMEM;
+	struct scratch_s *s = ctx->audio_scratch;
+
+	if (sampleCount < ctx->audioMaxSampleCount) {
+		sampleCount = ctx->audioMaxSampleCount;
 	}
-	ctx->Ms = malloc(ctx->audioMaxSampleCount * sizeof(float));
-	if (!ctx->Ms) {
+	if (klsmpte2064_scratch_reserve_audio(s, sampleCount, ctx->programCount) < 0) {
 		return -ENOMEM;
 	}
-	ctx->comp_bit = malloc(ctx->audioMaxSampleCount * sizeof(uint8_t));
-	if (!ctx->comp_bit) {
-		return -ENOMEM;
+
+	ctx->audioMaxSampleCount = s->audio_samples;
+	ctx->bufA = s->bufA;
+	ctx->Es = s->Es;
+	ctx->Ms = s->Ms;
+	ctx->comp_bit = s->comp_bit;
+	ctx->result = s->result;
+	ctx->programBuf = s->programBuf;
+
+	return 0;
+}
+
+/* Longest video frame in table 3, in samples at the input rate */
+static uint32_t _audio_frame_max(struct ctx_s *ctx)
+{
+	uint32_t max = 0;
+	for (int i = 0; i < (sizeof(tbl3) / sizeof(struct tbl3_s)); i++) {
+		uint64_t n = ((uint64_t)ctx->sample_rate * tbl3[i].timebase_num + tbl3[i].timebase_den - 1) / tbl3[i].timebase_den;
+		if (n > max) {
+			max = n;
+		}
 	}
-	ctx->result = malloc(ctx->audioMaxSampleCount * sizeof(uint8_t));
-	if (!ctx->result) {
+	return max;
+}
+
+/* Size the streaming accumulators for the longest frame in table 3,
+ * so the streaming push path never has to allocate.
+ */
+int klsmpte2064_audio_stream_alloc(struct ctx_s *ctx)
+{
+	ctx->stream_frame_max = _audio_frame_max(ctx);
+
+	ctx->stream_acc = klsmpte2064_mem_alloc(&ctx->allocator, AUDIOTYPE_MAX * ctx->stream_frame_max * sizeof(float));
+	if (!ctx->stream_acc || klsmpte2064_audio_bind(ctx, 0) < 0) {
 		return -ENOMEM;
 	}
 
 	return 0;
 }
 
-void klsmpte2064_audio_free(struct ctx_s *ctx)
+void klsmpte2064_audio_stream_free(struct ctx_s *ctx)
 {
-	if (ctx->bufA) {
-		free(ctx->bufA);
-		ctx->bufA = NULL;
-	}
-	if (ctx->Es) {
-		free(ctx->Es);
-		ctx->Es = NULL;
-	}
-	if (ctx->Ms) {
-		free(ctx->Ms);
-		ctx->Ms = NULL;
-	}
-	if (ctx->comp_bit) {
-		free(ctx->comp_bit);
-		ctx->comp_bit = NULL;
-	}
-	if (ctx->result) {
-		free(ctx->result);
-		ctx->result = NULL;
+	klsmpte2064_mem_free(&ctx->allocator, ctx->stream_acc);
+	ctx->stream_acc = NULL;
+}
+
+/* AudioMixType written into the container for each legacy input type */
+static uint8_t _audio_type_mixtype(enum klsmpte2064_audio_type_e type)
+{
+	switch (type) {
+	case AUDIOTYPE_STEREO_S16P:
+	case AUDIOTYPE_STEREO_S32_CH16_DECKLINK:
+		return 0x02; /* Downmix from 2.0-channel audio */
+	case AUDIOTYPE_SMPTE312_S32_CH16_DECKLINK:
+		return 0x05; /* Downmix from 5.1-channel audio */
+	default:
+		return 0x00; /* Reserved for future use by SMPTE */
 	}
 }
 
-int klsmpte2064_audio_push(void *hdl, enum klsmpte2064_audio_type_e type,
+/* Common argument checks and timebase discovery for the push calls */
+static int _audio_push_validate(struct ctx_s *ctx, enum klsmpte2064_audio_type_e type,
 	uint32_t timebase_num, uint32_t timebase_den,
-	const int16_t *planes[], uint32_t planeCount, uint32_t sampleCount)
+	const int16_t *planes[], uint32_t planeCount)
 {
-	struct ctx_s *ctx = (struct ctx_s *)hdl;
 	if (!ctx || !planeCount || type >= AUDIOTYPE_MAX) {
 		return -EINVAL;
 	}
@@ -430,34 +662,43 @@ int klsmpte2064_audio_push(void *hdl, enum klsmpte2064_audio_type_e type,
 		}
 		ctx->timebase_num = timebase_num;
 		ctx->timebase_den = timebase_den;
+	} else if (ctx->frame_rate && (timebase_num || timebase_den)) {
+		/* Table 3 was selected at allocation, audio for another rate is a caller error */
+		if (timebase_num != ctx->timebase_num || timebase_den != ctx->timebase_den) {
+			return -EINVAL;
+		}
 	}
 
-	/* Reset the fingerprint for the type */
-	klbs_init(&ctx->fp_bs[type]);
-
-	/* Section 5.3 - Audio Fingerprint Generation */
-
-	/* Step 5.3.1 - Downmix */
-	if (_audio_downmix(ctx, type, planes, planeCount, sampleCount, ctx->bufA) < 0) {
-		return -EINVAL;
-	}
+	return 0;
+}
 
+/* Section 5.3 - Audio Fingerprint Generation, steps 5.3.2 onwards.
+ * Takes one video frames worth of downmixed mono samples, the
+ * fingerprint lands in slot, the caller publishes it.
+ */
+static int _audio_fingerprint(struct ctx_s *ctx, int slot, float *bufA, uint32_t sampleCount)
+{
 	/* Step 5.3.2 - Pseudo Absolute Value */
-	_audio_pseudo_abs_value(ctx, sampleCount, ctx->bufA);
+	_audio_pseudo_abs_value(ctx, slot, sampleCount, bufA);
 
-	/* Step 5.3.3 - Envelope Detector */
-	_audio_envelope_detector(ctx, sampleCount, ctx->bufA, ctx->Es);
+	if (ctx->audio_pipeline != AUDIO_PIPELINE_FLOAT) {
+		/* Steps 5.3.3 to 5.3.5 in fixed point */
+		_audio_detect_fixed(ctx, sampleCount, bufA, ctx->comp_bit);
+	} else {
+		/* Step 5.3.3 - Envelope Detector */
+		_audio_envelope_detector(ctx, sampleCount, bufA, ctx->Es);
 
-	/* Step 5.3.4 - Local Mean Detector */
-	_audio_local_mean_detector(ctx, sampleCount, ctx->bufA, ctx->Ms);
+		/* Step 5.3.4 - Local Mean Detector */
+		_audio_local_mean_detector(ctx, sampleCount, bufA, ctx->Ms);
 
-	/* Step 5.3.5 - Envelope/Mean Comparator */
-	_audio_envelope_mean_comparator(ctx, sampleCount, ctx->Es, ctx->Ms, ctx->comp_bit);
+		/* Step 5.3.5 - Envelope/Mean Comparator */
+		_audio_envelope_mean_comparator(ctx, sampleCount, ctx->Es, ctx->Ms, ctx->comp_bit);
+	}
 
 	/* Step 5.3.6 - Decimator */
-	_audio_decimator(ctx, type, sampleCount, ctx->comp_bit, ctx->result);
+	_audio_decimator(ctx, slot, sampleCount, ctx->comp_bit, 1, ctx->result);
 
-	if (ctx->verbose) {
+	if (klsmpte2064_verbose(ctx)) {
 		printf("a fp: ");
 		for (int i = 0; i < ctx->t3->decimator_factor; i++) {
 			printf("%d", ctx->result[i]);
@@ -465,12 +706,12 @@ int klsmpte2064_audio_push(void *hdl, enum klsmpte2064_audio_type_e type,
 		printf("\n");
 	}
 
-	if (ctx->verbose > 1) {
+	if (klsmpte2064_verbose(ctx) > 1 && ctx->audio_pipeline == AUDIO_PIPELINE_FLOAT) {
 		int x = 24;
 
 		printf("As: ");
 		for (int i = 0; i < x; i++) {
-			printf("% 6.4f ", ctx->bufA[i]);
+			printf("% 6.4f ", bufA[i]);
 		}
 		printf("\n");
 		printf("Es: ");
@@ -502,3 +743,699 @@ int klsmpte2064_audio_push(void *hdl, enum klsmpte2064_audio_type_e type,
 
 	return 0;
 }
+
+static int _audio_push(struct ctx_s *ctx, enum klsmpte2064_audio_type_e type,
+	uint32_t timebase_num, uint32_t timebase_den,
+	const int16_t *planes[], uint32_t planeCount, uint32_t sampleCount)
+{
+	int r = _audio_push_validate(ctx, type, timebase_num, timebase_den, planes, planeCount);
+	if (r < 0) {
+		return r;
+	}
+
+	if (klsmpte2064_audio_bind(ctx, sampleCount) < 0) {
+		return -ENOMEM;
+	}
+
+	/* Reset the fingerprint for the type */
+	klbs_init(&ctx->fp_bs[type]);
+	ctx->afp_mixtype[type] = _audio_type_mixtype(type);
+
+	/* Step 5.3.1 - Downmix */
+	if (_audio_downmix(ctx, type, planes, planeCount, sampleCount, ctx->bufA) < 0) {
+		return -EINVAL;
+	}
+	if (ctx->decimate > 1) {
+		sampleCount = klsmpte2064_audio_decimate(&ctx->decim[type], ctx->decimate, ctx->bufA, sampleCount, ctx->bufA);
+	}
+
+	_audio_fingerprint(ctx, type, ctx->bufA, sampleCount);
+
+	/* Make the fingerprint visible to the pack step */
+	klsmpte2064_publish_audio(ctx, 1 << type);
+
+	return 0;
+}
+
+int klsmpte2064_audio_push(void *hdl, enum klsmpte2064_audio_type_e type,
+	uint32_t timebase_num, uint32_t timebase_den,
+	const int16_t *planes[], uint32_t planeCount, uint32_t sampleCount)
+{
+	struct ctx_s *ctx = (struct ctx_s *)hdl;
+
+	uint64_t start = klsmpte2064_governor_start(ctx);
+	int r = _audio_push(ctx, type, timebase_num, timebase_den, planes, planeCount, sampleCount);
+	klsmpte2064_governor_audio(ctx, start);
+
+	return r;
+}
+
+#if !ORIGINAL_SPEC_IMPLEMENTATION
+/* Steps 5.3.3 to 5.3.5 for AUDIO_BATCH_LANES independent streams side by side.
+ * x holds the pseudo absolute samples sample major, [sample][lane], so each step
+ * of the envelope and mean recursions advances every lane with one vector
+ * multiply-add. Same arithmetic, in the same order, as the single stream path.
+ */
+static void _audio_detect_lanes(const float *x, uint32_t sampleCount,
+	const float *alpha, const float *beta, uint8_t *comp)
+{
+	const float delta = 0.015f;
+	float Es[AUDIO_BATCH_LANES], Ms[AUDIO_BATCH_LANES];
+	float ka[AUDIO_BATCH_LANES], kb[AUDIO_BATCH_LANES];
+
+	for (int l = 0; l < AUDIO_BATCH_LANES; l++) {
+		ka[l] = 1.0f - alpha[l];
+		kb[l] = 1.0f - beta[l];
+		Es[l] = x[l];
+		Ms[l] = x[l];
+		comp[l] = (Ms[l] + delta) < Es[l];
+	}
+
+	for (uint32_t i = 1; i < sampleCount; i++) {
+		const float *xi = x + (i * AUDIO_BATCH_LANES);
+		uint8_t *ci = comp + (i * AUDIO_BATCH_LANES);
+		for (int l = 0; l < AUDIO_BATCH_LANES; l++) {
+			Es[l] = alpha[l] * xi[l] + ka[l] * Es[l];
+			Ms[l] = beta[l] * xi[l] + kb[l] * Ms[l];
+			ci[l] = (Ms[l] + delta) < Es[l];
+		}
+	}
+}
+#endif
+
+/* _audio_detect_fixed() for AUDIO_PIPELINE_FIXED, in lanes. Integer SIMD, the
+ * Q30 products are the only 64bit operations.
+ */
+static void _audio_detect_lanes_fixed(const float *x, uint32_t sampleCount,
+	const int32_t *alpha, const int32_t *beta, uint8_t *comp)
+{
+	int32_t Es[AUDIO_BATCH_LANES], Ms[AUDIO_BATCH_LANES];
+
+	for (int l = 0; l < AUDIO_BATCH_LANES; l++) {
+		Es[l] = _audio_fixed_sample(x[l]) << 15;
+		Ms[l] = Es[l];
+		comp[l] = (Ms[l] + AUDIO_FIXED_DELTA) < Es[l];
+	}
+
+	for (uint32_t i = 1; i < sampleCount; i++) {
+		const float *xi = x + (i * AUDIO_BATCH_LANES);
+		uint8_t *ci = comp + (i * AUDIO_BATCH_LANES);
+		for (int l = 0; l < AUDIO_BATCH_LANES; l++) {
+			int32_t v = _audio_fixed_sample(xi[l]) << 15;
+			Es[l] += (int32_t)(((int64_t)(v - Es[l]) * alpha[l]) >> 16);
+			Ms[l] += (int32_t)(((int64_t)(v - Ms[l]) * beta[l]) >> 16);
+			ci[l] = (Ms[l] + AUDIO_FIXED_DELTA) < Es[l];
+		}
+	}
+}
+
+/* _audio_detect_fixed() for AUDIO_PIPELINE_FIXED_SPEC, in lanes. 32bit adds and shifts only. */
+static void _audio_detect_lanes_spec(const float *x, uint32_t sampleCount, uint8_t *comp)
+{
+	int32_t Es[AUDIO_BATCH_LANES] = { 0 }, Ms[AUDIO_BATCH_LANES] = { 0 };
+
+	memset(comp, 0, AUDIO_BATCH_LANES);
+
+	for (uint32_t i = 1; i < sampleCount; i++) {
+		const float *xi = x + (i * AUDIO_BATCH_LANES);
+		uint8_t *ci = comp + (i * AUDIO_BATCH_LANES);
+		for (int l = 0; l < AUDIO_BATCH_LANES; l++) {
+			int32_t a = _audio_fixed_sample(xi[l]);
+			Ms[l] = a + Ms[l] - (Ms[l] >> AUDIO_SPEC_MS_SHIFT);
+			Es[l] = (a << AUDIO_SPEC_ES_GAIN) + Es[l] - (Es[l] >> AUDIO_SPEC_ES_SHIFT);
+			ci[l] = Ms[l] < Es[l];
+		}
+	}
+}
+
+/* Fingerprint up to AUDIO_BATCH_LANES contexts, one lane each, all using pipeline.
+ * The lanes are staged in the first contexts audio scratch, every other
+ * context only uses its own scratch while its samples are being transposed.
+ */
+static int _audio_push_lanes(struct ctx_s *ctxs[], uint32_t lanes, enum klsmpte2064_audio_pipeline_e pipeline,
+	enum klsmpte2064_audio_type_e type, uint32_t timebase_num, uint32_t timebase_den,
+	const int16_t **planes[], uint32_t planeCount, const uint32_t sampleCounts[], int results[])
+{
+	struct scratch_s *ws = NULL;
+	uint32_t counts[AUDIO_BATCH_LANES] = { 0 };
+	float alpha[AUDIO_BATCH_LANES] = { 0 }, beta[AUDIO_BATCH_LANES] = { 0 };
+	int32_t qalpha[AUDIO_BATCH_LANES] = { 0 }, qbeta[AUDIO_BATCH_LANES] = { 0 };
+	uint32_t max = 0;
+
+	for (uint32_t l = 0; l < lanes; l++) {
+		results[l] = _audio_push_validate(ctxs[l], type, timebase_num, timebase_den, planes[l], planeCount);
+		if (results[l] == 0) {
+			if (!ws) {
+				ws = ctxs[l]->audio_scratch;
+			}
+			if (sampleCounts[l] > max) {
+				max = sampleCounts[l];
+			}
+		}
+	}
+	if (!ws) {
+		return 0;
+	}
+	if (klsmpte2064_scratch_reserve_batch(ws, max) < 0) {
+		for (uint32_t l = 0; l < lanes; l++) {
+			if (results[l] == 0) {
+				results[l] = -ENOMEM;
+			}
+		}
+		return 0;
+	}
+	memset(ws->batch_x, 0, max * AUDIO_BATCH_LANES * sizeof(float));
+
+	/* Step 5.3.1 and 5.3.2 per context, transposed into the lanes */
+	for (uint32_t l = 0; l < lanes; l++) {
+		struct ctx_s *ctx = ctxs[l];
+		if (results[l] < 0) {
+			continue;
+		}
+		if (klsmpte2064_audio_bind(ctx, sampleCounts[l]) < 0) {
+			results[l] = -ENOMEM;
+			continue;
+		}
+
+		klbs_init(&ctx->fp_bs[type]);
+		ctx->afp_mixtype[type] = _audio_type_mixtype(type);
+
+		uint32_t n = sampleCounts[l];
+		if (_audio_downmix(ctx, type, planes[l], planeCount, n, ctx->bufA) < 0) {
+			results[l] = -EINVAL;
+			continue;
+		}
+		if (ctx->decimate > 1) {
+			n = klsmpte2064_audio_decimate(&ctx->decim[type], ctx->decimate, ctx->bufA, n, ctx->bufA);
+		}
+		_audio_pseudo_abs_value(ctx, type, n, ctx->bufA);
+
+		for (uint32_t i = 0; i < n; i++) {
+			ws->batch_x[(i * AUDIO_BATCH_LANES) + l] = ctx->bufA[i];
+		}
+		counts[l] = n;
+		if (pipeline == AUDIO_PIPELINE_FIXED) {
+			qalpha[l] = _audio_fixed_coefficient(ctx, AUDIO_FIXED_ALPHA);
+			qbeta[l] = _audio_fixed_coefficient(ctx, AUDIO_FIXED_BETA);
+		} else {
+			alpha[l] = _audio_rate_coefficient(ctx, 0.25f);
+			beta[l] = _audio_rate_coefficient(ctx, 0.005f);
+		}
+	}
+
+	/* Steps 5.3.3 to 5.3.5, every lane at once. Short lanes run on
+	 * over zeros, their extra bits are never read.
+	 */
+	uint32_t longest = 0;
+	for (uint32_t l = 0; l < lanes; l++) {
+		if (counts[l] > longest) {
+			longest = counts[l];
+		}
+	}
+	if (longest) {
+		switch (pipeline) {
+		case AUDIO_PIPELINE_FIXED:
+			_audio_detect_lanes_fixed(ws->batch_x, longest, qalpha, qbeta, ws->batch_comp);
+			break;
+		case AUDIO_PIPELINE_FIXED_SPEC:
+			_audio_detect_lanes_spec(ws->batch_x, longest, ws->batch_comp);
+			break;
+		default:
+#if !ORIGINAL_SPEC_IMPLEMENTATION
+			_audio_detect_lanes(ws->batch_x, longest, alpha, beta, ws->batch_comp);
+#endif
+			break;
+		}
+	}
+
+	/* Step 5.3.6 per context, straight from the lanes */
+	for (uint32_t l = 0; l < lanes; l++) {
+		struct ctx_s *ctx = ctxs[l];
+		if (results[l] < 0 || counts[l] == 0) {
+			continue;
+		}
+		/* A shared scratch may have grown while later lanes were bound */
+		klsmpte2064_audio_bind(ctx, 0);
+		_audio_decimator(ctx, type, counts[l], ws->batch_comp + l, AUDIO_BATCH_LANES, ctx->result);
+
+		/* Make the fingerprint visible to the pack step */
+		klsmpte2064_publish_audio(ctx, 1 << type);
+	}
+
+	return 0;
+}
+
+/* Push one group of lanes sharing a pipeline, results land at their index in the batch */
+static int _audio_push_group(struct ctx_s *group[], uint32_t lanes, enum klsmpte2064_audio_pipeline_e pipeline,
+	enum klsmpte2064_audio_type_e type, uint32_t timebase_num, uint32_t timebase_den,
+	const int16_t **planes[], uint32_t planeCount, const uint32_t sampleCounts[],
+	const uint32_t index[], int results[])
+{
+	int r[AUDIO_BATCH_LANES];
+	int ret = 0;
+
+	/* Timed as a whole, each governed context is charged its share */
+	uint64_t start = 0;
+	for (uint32_t l = 0; l < lanes && !start; l++) {
+		start = klsmpte2064_governor_start(group[l]);
+	}
+
+#if ORIGINAL_SPEC_IMPLEMENTATION
+	if (pipeline == AUDIO_PIPELINE_FLOAT) {
+		/* The float spec detectors aren't laned */
+		for (uint32_t l = 0; l < lanes; l++) {
+			r[l] = _audio_push(group[l], type, timebase_num, timebase_den,
+				planes[l], planeCount, sampleCounts[l]);
+		}
+	} else
+#endif
+	_audio_push_lanes(group, lanes, pipeline, type, timebase_num, timebase_den,
+		planes, planeCount, sampleCounts, r);
+
+	if (start) {
+		uint64_t share = (klsmpte2064_governor_clock() - start) / lanes;
+		for (uint32_t l = 0; l < lanes; l++) {
+			if (group[l] && group[l]->governor_enabled) {
+				__atomic_fetch_add(&group[l]->governor_audio_ns, share, __ATOMIC_RELAXED);
+			}
+		}
+	}
+
+	for (uint32_t l = 0; l < lanes; l++) {
+		if (results) {
+			results[index[l]] = r[l];
+		}
+		if (r[l] < 0 && ret == 0) {
+			ret = r[l];
+		}
+	}
+
+	return ret;
+}
+
+int klsmpte2064_audio_push_batch(void *hdls[], enum klsmpte2064_audio_type_e type,
+	uint32_t timebase_num, uint32_t timebase_den,
+	const int16_t **planes[], uint32_t planeCount, const uint32_t sampleCounts[],
+	uint32_t count, int results[])
+{
+	if (!hdls || !planes || !sampleCounts) {
+		return -EINVAL;
+	}
+
+	int ret = 0;
+
+	/* Lanes share a detector, group the contexts by pipeline, keeping their order.
+	 * Invalid handles land in the float group and fail validation there.
+	 */
+	for (int p = AUDIO_PIPELINE_FLOAT; p < AUDIO_PIPELINE_MAX; p++) {
+		struct ctx_s *group[AUDIO_BATCH_LANES];
+		const int16_t **groupPlanes[AUDIO_BATCH_LANES];
+		uint32_t groupCounts[AUDIO_BATCH_LANES];
+		uint32_t index[AUDIO_BATCH_LANES];
+		uint32_t lanes = 0;
+		int r;
+
+		for (uint32_t i = 0; i < count; i++) {
+			struct ctx_s *ctx = (struct ctx_s *)hdls[i];
+			if ((ctx ? ctx->audio_pipeline : AUDIO_PIPELINE_FLOAT) != p) {
+				continue;
+			}
+			group[lanes] = ctx;
+			groupPlanes[lanes] = planes[i];
+			groupCounts[lanes] = sampleCounts[i];
+			index[lanes++] = i;
+			if (lanes == AUDIO_BATCH_LANES) {
+				r = _audio_push_group(group, lanes, p, type, timebase_num, timebase_den,
+					groupPlanes, planeCount, groupCounts, index, results);
+				if (r < 0 && ret == 0) {
+					ret = r;
+				}
+				lanes = 0;
+			}
+		}
+		if (lanes) {
+			r = _audio_push_group(group, lanes, p, type, timebase_num, timebase_den,
+				groupPlanes, planeCount, groupCounts, index, results);
+			if (r < 0 && ret == 0) {
+				ret = r;
+			}
+		}
+	}
+
+	return ret;
+}
+
+int klsmpte2064_audio_set_silence_level(void *hdl, float dbfs)
+{
+	struct ctx_s *ctx = (struct ctx_s *)hdl;
+	if (!ctx || !(dbfs >= -120.0f && dbfs <= 0.0f)) {
+		return -EINVAL;
+	}
+
+	ctx->silence_level = powf(10.0f, dbfs / 20.0f);
+
+	return 0;
+}
+
+static int _audio_levels_query(struct ctx_s *ctx, int slot, struct klsmpte2064_audio_levels_s *levels)
+{
+	uint32_t seq;
+	do {
+		seq = seqlock_read_begin(&ctx->audio_pub_seq);
+		*levels = ctx->levels_pub[slot];
+	} while (seqlock_read_retry(&ctx->audio_pub_seq, seq));
+
+	return levels->frames ? 0 : -EAGAIN;
+}
+
+int klsmpte2064_audio_levels_query(void *hdl, enum klsmpte2064_audio_type_e type, struct klsmpte2064_audio_levels_s *levels)
+{
+	struct ctx_s *ctx = (struct ctx_s *)hdl;
+	if (!ctx || !levels || type <= AUDIOTYPE_UNDEFINED || type >= AUDIOTYPE_MAX) {
+		return -EINVAL;
+	}
+
+	return _audio_levels_query(ctx, type, levels);
+}
+
+int klsmpte2064_audio_program_levels_query(void *hdl, uint32_t program, struct klsmpte2064_audio_levels_s *levels)
+{
+	struct ctx_s *ctx = (struct ctx_s *)hdl;
+	if (!ctx || !levels || program >= KLSMPTE2064_AUDIO_PROGRAMS_MAX) {
+		return -EINVAL;
+	}
+
+	return _audio_levels_query(ctx, AFP_SLOT_PROGRAM(program), levels);
+}
+
+int klsmpte2064_audio_set_pipeline(void *hdl, enum klsmpte2064_audio_pipeline_e pipeline)
+{
+	struct ctx_s *ctx = (struct ctx_s *)hdl;
+	if (!ctx || pipeline < AUDIO_PIPELINE_FLOAT || pipeline >= AUDIO_PIPELINE_MAX) {
+		return -EINVAL;
+	}
+
+	ctx->audio_pipeline = pipeline;
+
+	return 0;
+}
+
+int klsmpte2064_audio_set_programs(void *hdl, const struct klsmpte2064_audio_program_s *programs, uint32_t programCount)
+{
+	struct ctx_s *ctx = (struct ctx_s *)hdl;
+	if (!ctx || programCount > KLSMPTE2064_AUDIO_PROGRAMS_MAX || (programCount && !programs)) {
+		return -EINVAL;
+	}
+	for (uint32_t p = 0; p < programCount; p++) {
+		if (programs[p].channelCount == 0 || programs[p].channelCount > KLSMPTE2064_AUDIO_PROGRAM_CHANNELS_MAX) {
+			return -EINVAL;
+		}
+		/* 6.1 - Table 5 - AudioMixType is 3 bits */
+		if (programs[p].mixType > 0x07) {
+			return -EINVAL;
+		}
+	}
+
+	memcpy(&ctx->programs[0], programs, programCount * sizeof(struct klsmpte2064_audio_program_s));
+	ctx->programCount = programCount;
+
+	/* Reserve the program buffers now, so the push calls don't allocate */
+	if (klsmpte2064_audio_bind(ctx, 0) < 0) {
+		ctx->programCount = 0;
+		return -ENOMEM;
+	}
+	ctx->downmix.loader = NULL; /* Recompiled for the input layout on the next push */
+
+	/* Retire fingerprints from programs that no longer exist */
+	uint32_t mask = 0;
+	for (int p = 0; p < KLSMPTE2064_AUDIO_PROGRAMS_MAX; p++) {
+		if (p >= programCount) {
+			klbs_init(&ctx->fp_bs[AFP_SLOT_PROGRAM(p)]);
+		}
+		memset(&ctx->decim[AFP_SLOT_PROGRAM(p)], 0, sizeof(struct audio_decimate_s));
+		memset(&ctx->levels[AFP_SLOT_PROGRAM(p)], 0, sizeof(struct klsmpte2064_audio_levels_s));
+		ctx->audio_clips[AFP_SLOT_PROGRAM(p)] = 0;
+		ctx->afp_mixtype[AFP_SLOT_PROGRAM(p)] = p < programCount ? programs[p].mixType : 0;
+		mask |= 1 << AFP_SLOT_PROGRAM(p);
+	}
+	klsmpte2064_publish_audio(ctx, mask);
+
+	pthread_mutex_lock(&ctx->align_mutex);
+	ctx->align_audio_mask &= ~mask;
+	klsmpte2064_emit_retire(ctx, mask);
+	pthread_mutex_unlock(&ctx->align_mutex);
+
+	return 0;
+}
+
+/* Downmix and fingerprint every program, the plan has been built for the input layout */
+static int _audio_programs_fingerprint(struct ctx_s *ctx, const void *planes[], uint32_t sampleCount)
+{
+	if (klsmpte2064_audio_bind(ctx, sampleCount) < 0) {
+		return -ENOMEM;
+	}
+
+	/* Step 5.3.1 - Downmix, all programs in a single pass */
+	sampleCount = klsmpte2064_downmix_run(ctx, planes, sampleCount);
+
+	uint32_t mask = 0;
+	for (uint32_t p = 0; p < ctx->programCount; p++) {
+		_audio_fingerprint(ctx, AFP_SLOT_PROGRAM(p), ctx->programBuf + (p * ctx->audioMaxSampleCount), sampleCount);
+		mask |= 1 << AFP_SLOT_PROGRAM(p);
+	}
+
+	/* Make all of the program fingerprints visible to the pack step together */
+	klsmpte2064_publish_audio(ctx, mask);
+
+	return 0;
+}
+
+int klsmpte2064_audio_programs_push(void *hdl, uint32_t timebase_num, uint32_t timebase_den,
+	const int32_t *samples, uint32_t channelCount, uint32_t sampleCount)
+{
+	struct ctx_s *ctx = (struct ctx_s *)hdl;
+	const int16_t *planes[] = { (const int16_t *)samples };
+	int r = _audio_push_validate(ctx, AUDIOTYPE_UNDEFINED, timebase_num, timebase_den, planes, 1);
+	if (r < 0) {
+		return r;
+	}
+	if (!ctx->programCount) {
+		return -EINVAL;
+	}
+
+	/* Interleaved S32, only recompile the plan when the layout changes */
+	struct downmix_plan_s *plan = &ctx->downmix;
+	if (!plan->loader || plan->format != SAMPLEFORMAT_S32 || plan->planar || plan->channelCount != channelCount) {
+		r = klsmpte2064_downmix_build(ctx, SAMPLEFORMAT_S32, 0, channelCount);
+		if (r < 0) {
+			return r;
+		}
+	}
+
+	const void *in[] = { samples };
+	uint64_t start = klsmpte2064_governor_start(ctx);
+	r = _audio_programs_fingerprint(ctx, in, sampleCount);
+	klsmpte2064_governor_audio(ctx, start);
+
+	return r;
+}
+
+int klsmpte2064_audio_set_downmix(void *hdl, enum klsmpte2064_sample_format_e format, uint32_t planar,
+	uint32_t channelCount, const struct klsmpte2064_audio_program_s *programs, uint32_t programCount)
+{
+	struct ctx_s *ctx = (struct ctx_s *)hdl;
+	if (!ctx || programCount == 0 || planar > 1) {
+		return -EINVAL;
+	}
+
+	int r = klsmpte2064_audio_set_programs(hdl, programs, programCount);
+	if (r < 0) {
+		return r;
+	}
+
+	r = klsmpte2064_downmix_build(ctx, format, planar, channelCount);
+	if (r < 0) {
+		klsmpte2064_audio_set_programs(hdl, NULL, 0);
+		return r;
+	}
+
+	return 0;
+}
+
+int klsmpte2064_audio_downmix_push(void *hdl, uint32_t timebase_num, uint32_t timebase_den,
+	const void *planes[], uint32_t sampleCount)
+{
+	struct ctx_s *ctx = (struct ctx_s *)hdl;
+	const int16_t *p[] = { planes ? (const int16_t *)planes[0] : NULL };
+	int r = _audio_push_validate(ctx, AUDIOTYPE_UNDEFINED, timebase_num, timebase_den, p, 1);
+	if (r < 0) {
+		return r;
+	}
+	if (!ctx->programCount || !ctx->downmix.loader) {
+		return -EINVAL;
+	}
+	if (ctx->downmix.planar) {
+		for (uint32_t u = 0; u < ctx->downmix.usedCount; u++) {
+			if (!planes[ctx->downmix.used[u]]) {
+				return -EINVAL;
+			}
+		}
+	}
+
+	uint64_t start = klsmpte2064_governor_start(ctx);
+	r = _audio_programs_fingerprint(ctx, planes, sampleCount);
+	klsmpte2064_governor_audio(ctx, start);
+
+	return r;
+}
+
+/* Number of samples in video frame 'frame', for the contexts timebase.
+ * Non integer rates alternate, Eg. 59.94 gives 800, 801, 801, 801, 801
+ * and 29.97 gives 1601, 1602, 1601, 1602, 1602, repeating every 5 frames.
+ */
+static uint32_t _audio_stream_frame_samples(struct ctx_s *ctx, uint64_t frame)
+{
+	uint64_t start = (frame * ctx->sample_rate * ctx->timebase_num) / ctx->timebase_den;
+	uint64_t end = ((frame + 1) * ctx->sample_rate * ctx->timebase_num) / ctx->timebase_den;
+
+	return end - start;
+}
+
+/* Advance the plane pointers by 'offset' samples, per the layout of each type */
+static int _audio_offset_planes(enum klsmpte2064_audio_type_e type, const int16_t *planes[], uint32_t planeCount,
+	uint32_t offset, const int16_t *out[])
+{
+	switch (type) {
+	case AUDIOTYPE_STEREO_S16P:
+		if (planeCount < 2) {
+			return -EINVAL;
+		}
+		out[0] = planes[0] + offset;
+		out[1] = planes[1] + offset;
+		return 0;
+	case AUDIOTYPE_STEREO_S32_CH16_DECKLINK:
+	case AUDIOTYPE_SMPTE312_S32_CH16_DECKLINK:
+		/* Interleaved, 16 channels of S32 per sample */
+		out[0] = (const int16_t *)((const int32_t *)planes[0] + (offset * 16));
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
+static int _audio_stream_push(struct ctx_s *ctx, enum klsmpte2064_audio_type_e type,
+	uint32_t timebase_num, uint32_t timebase_den,
+	const int16_t *planes[], uint32_t planeCount, uint32_t sampleCount)
+{
+	int r = _audio_push_validate(ctx, type, timebase_num, timebase_den, planes, planeCount);
+	if (r < 0) {
+		return r;
+	}
+	/* A shared scratch may have been grown, and its buffers moved, by another context */
+	if (klsmpte2064_audio_bind(ctx, ctx->stream_frame_max) < 0) {
+		return -ENOMEM;
+	}
+	if (!ctx->stream_acc) {
+		return -ENOMEM;
+	}
+
+	float *acc = ctx->stream_acc + (type * ctx->stream_frame_max);
+	int fingerprints = 0;
+	uint32_t offset = 0;
+
+	while (offset < sampleCount) {
+		uint32_t frameSamples = _audio_stream_frame_samples(ctx, ctx->stream_frames[type]);
+		uint32_t n = frameSamples - ctx->stream_count[type];
+		if (n > sampleCount - offset) {
+			n = sampleCount - offset;
+		}
+
+		/* Step 5.3.1 - Downmix, straight into the accumulator */
+		const int16_t *p[2];
+		if (_audio_offset_planes(type, planes, planeCount, offset, p) < 0) {
+			return -EINVAL;
+		}
+		if (_audio_downmix(ctx, type, p, planeCount, n, acc + ctx->stream_count[type]) < 0) {
+			return -EINVAL;
+		}
+		ctx->stream_count[type] += n;
+		offset += n;
+
+		if (ctx->stream_count[type] == frameSamples) {
+			ctx->afp_mixtype[type] = _audio_type_mixtype(type);
+			uint32_t analysisSamples = frameSamples;
+			if (ctx->decimate > 1) {
+				analysisSamples = klsmpte2064_audio_decimate(&ctx->decim[type], ctx->decimate, acc, frameSamples, acc);
+			}
+			_audio_fingerprint(ctx, type, acc, analysisSamples);
+			klsmpte2064_publish_audio(ctx, 1 << type);
+			ctx->stream_count[type] = 0;
+			ctx->stream_frames[type]++;
+			fingerprints++;
+		}
+	}
+
+	return fingerprints;
+}
+
+int klsmpte2064_audio_stream_push(void *hdl, enum klsmpte2064_audio_type_e type,
+	uint32_t timebase_num, uint32_t timebase_den,
+	const int16_t *planes[], uint32_t planeCount, uint32_t sampleCount)
+{
+	struct ctx_s *ctx = (struct ctx_s *)hdl;
+
+	uint64_t start = klsmpte2064_governor_start(ctx);
+	int r = _audio_stream_push(ctx, type, timebase_num, timebase_den, planes, planeCount, sampleCount);
+	klsmpte2064_governor_audio(ctx, start);
+
+	return r;
+}
+
+int klsmpte2064_audio_signal_discontinuity(void *hdl)
+{
+	struct ctx_s *ctx = (struct ctx_s *)hdl;
+	if (!ctx) {
+		return -EINVAL;
+	}
+
+	/* A partial frame straddling the gap would be fingerprinted as one,
+	 * drop it. Frame counts are kept, the sample cadence continues.
+	 */
+	memset(&ctx->stream_count[0], 0, sizeof(ctx->stream_count));
+	memset(&ctx->decim[0], 0, sizeof(ctx->decim));
+
+	return 0;
+}
+
+int klsmpte2064_audio_set_samplerate(void *hdl, uint32_t sampleRate, uint32_t flags)
+{
+	struct ctx_s *ctx = (struct ctx_s *)hdl;
+	if (!ctx || sampleRate < 8000 || sampleRate > 192000) {
+		return -EINVAL;
+	}
+	if (flags & ~KLSMPTE2064_AUDIO_SAMPLERATE_DECIMATE) {
+		return -EINVAL;
+	}
+
+	ctx->sample_rate = sampleRate;
+	ctx->decimate = 1;
+	if (flags & KLSMPTE2064_AUDIO_SAMPLERATE_DECIMATE) {
+		/* Integer factor down to 44.1 or 48KHz, Eg. 96KHz by 2, 176.4KHz by 4 */
+		ctx->decimate = sampleRate / 44100;
+		if (ctx->decimate < 1) {
+			ctx->decimate = 1;
+		}
+	}
+	memset(&ctx->decim[0], 0, sizeof(ctx->decim));
+
+	/* Size everything for the longest frame at this rate, up front */
+	if (klsmpte2064_audio_bind(ctx, _audio_frame_max(ctx)) < 0) {
+		return -ENOMEM;
+	}
+
+	klsmpte2064_audio_stream_free(ctx);
+	memset(&ctx->stream_count[0], 0, sizeof(ctx->stream_count));
+	memset(&ctx->stream_frames[0], 0, sizeof(ctx->stream_frames));
+
+	return klsmpte2064_audio_stream_alloc(ctx);
+}
@@ -47,15 +47,16 @@ void v210_planar_unpack_c_10b(const uint32_t *src, uint32_t src_stride, uint16_t
 #endif
 
 /* Unpack a line of V210 4:2:2 10bit into three seperate planes of 8bit.
- * Decimate by losing the top two bits.
+ * Decimate by losing the bottom two bits, 5.2 "Only the 8 most significant
+ * bits of the luminance samples shall be used".
  * If the plane isn't specified, throw the data away.
  */
 #define READ_PIXELS_8b(a, b, c)         \
     do {                             \
         val  = av_le2ne32( *src++ ); \
-        if (a) *a++ =  val & 0xff;         \
-        if (b) *b++ = (val >> 10) & 0xff;  \
-        if (c) *c++ = (val >> 20) & 0xff;  \
+        if (a) *a++ = (val >>  2) & 0xff;  \
+        if (b) *b++ = (val >> 12) & 0xff;  \
+        if (c) *c++ = (val >> 22) & 0xff;  \
     } while (0)
 
 /* Convert a single line of V210 10bit to 8bit.
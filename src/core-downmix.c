@@ -0,0 +1,246 @@
+#include <libklsmpte2064/klsmpte2064.h>
+
+#include "core-private.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* Generic matrix downmix engine - 5.3.1.
+ *
+ * The program descriptors are compiled once, at setup time, into a plan:
+ *  - the list of input channels any program actually references,
+ *  - a dense programs x referenced-channels coefficient matrix,
+ *  - a loader specialised for the input sample format and layout.
+ * At push time the loader converts a block of samples for the referenced
+ * channels only into float rows, then each program is accumulated as a
+ * row-wise multiply-add. The inner loops are contiguous float arrays with
+ * no aliasing, which the compiler vectorises (SSE/AVX/NEON) at -O3.
+ */
+
+#define DOWNMIX_BLOCK 64
+
+/* Read a single sample and normalize it into -1.0 .. 1.0 */
+static inline __attribute__((always_inline)) float _downmix_sample(const uint8_t *base, uint32_t idx,
+	enum klsmpte2064_sample_format_e format)
+{
+	const uint8_t *b;
+
+	switch (format) {
+	case SAMPLEFORMAT_S16:
+		return (float)((const int16_t *)base)[idx] * (1.0f / 32768.0f);
+	case SAMPLEFORMAT_S24LE:
+		b = base + (idx * 3);
+		return (float)((int32_t)(((uint32_t)b[0] << 8) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 24)) >> 8) * (1.0f / 8388608.0f);
+	case SAMPLEFORMAT_S24BE:
+		b = base + (idx * 3);
+		return (float)((int32_t)(((uint32_t)b[2] << 8) | ((uint32_t)b[1] << 16) | ((uint32_t)b[0] << 24)) >> 8) * (1.0f / 8388608.0f);
+	case SAMPLEFORMAT_S32:
+		return (float)((const int32_t *)base)[idx] * (1.0f / 2147483648.0f);
+	default:
+		return 0;
+	}
+}
+
+/* Normalized magnitude of the largest positive sample, at or above is clipped */
+static inline __attribute__((always_inline)) float _downmix_full_scale(enum klsmpte2064_sample_format_e format)
+{
+	switch (format) {
+	case SAMPLEFORMAT_S16:
+		return 32767.0f / 32768.0f;
+	case SAMPLEFORMAT_S24LE:
+	case SAMPLEFORMAT_S24BE:
+		return 8388607.0f / 8388608.0f;
+	default:
+		return 1.0f; /* S32 full scale rounds to 1.0 as a float */
+	}
+}
+
+/* Convert count samples, starting at offset, of every referenced channel
+ * into rows of DOWNMIX_BLOCK floats. Full scale samples are counted per row into clips.
+ */
+static inline __attribute__((always_inline)) void _downmix_load(const struct downmix_plan_s *plan, const void *planes[],
+	uint32_t offset, uint32_t count, float *rows, uint32_t *clips, enum klsmpte2064_sample_format_e format, int planar)
+{
+	const float fs = _downmix_full_scale(format);
+
+	for (uint32_t u = 0; u < plan->usedCount; u++) {
+		float *dst = rows + (u * DOWNMIX_BLOCK);
+		uint32_t ch = plan->used[u];
+		uint32_t n = 0;
+
+		if (planar) {
+			const uint8_t *base = (const uint8_t *)planes[ch];
+			for (uint32_t i = 0; i < count; i++) {
+				dst[i] = _downmix_sample(base, offset + i, format);
+				n += fabsf(dst[i]) >= fs;
+			}
+		} else {
+			const uint8_t *base = (const uint8_t *)planes[0];
+			for (uint32_t i = 0; i < count; i++) {
+				dst[i] = _downmix_sample(base, ((offset + i) * plan->channelCount) + ch, format);
+				n += fabsf(dst[i]) >= fs;
+			}
+		}
+		clips[u] += n;
+	}
+}
+
+#define DOWNMIX_LOADER(name, format, planar) \
+static void _downmix_load_##name(const struct downmix_plan_s *plan, const void *planes[], \
+	uint32_t offset, uint32_t count, float *rows, uint32_t *clips) \
+{ \
+	_downmix_load(plan, planes, offset, count, rows, clips, format, planar); \
+}
+
+DOWNMIX_LOADER(s16,     SAMPLEFORMAT_S16,   0)
+DOWNMIX_LOADER(s16p,    SAMPLEFORMAT_S16,   1)
+DOWNMIX_LOADER(s24le,   SAMPLEFORMAT_S24LE, 0)
+DOWNMIX_LOADER(s24lep,  SAMPLEFORMAT_S24LE, 1)
+DOWNMIX_LOADER(s24be,   SAMPLEFORMAT_S24BE, 0)
+DOWNMIX_LOADER(s24bep,  SAMPLEFORMAT_S24BE, 1)
+DOWNMIX_LOADER(s32,     SAMPLEFORMAT_S32,   0)
+DOWNMIX_LOADER(s32p,    SAMPLEFORMAT_S32,   1)
+
+/* out[i] += coef * in[i] */
+static void _downmix_madd(float * restrict out, const float * restrict in, float coef, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; i++) {
+		out[i] += coef * in[i];
+	}
+}
+
+/* Compile the programs in the context into a downmix plan.
+ * Returns < 0 if a program references a channel beyond channelCount.
+ */
+int klsmpte2064_downmix_build(struct ctx_s *ctx, enum klsmpte2064_sample_format_e format, int planar, uint32_t channelCount)
+{
+	struct downmix_plan_s *plan = &ctx->downmix;
+
+	if (format <= SAMPLEFORMAT_UNDEFINED || format >= SAMPLEFORMAT_MAX) {
+		return -EINVAL;
+	}
+	if (channelCount == 0 || channelCount > KLSMPTE2064_AUDIO_INPUT_CHANNELS_MAX) {
+		return -EINVAL;
+	}
+
+	/* Map of input channel to matrix column, -1 when unreferenced */
+	int column[KLSMPTE2064_AUDIO_INPUT_CHANNELS_MAX];
+	for (int i = 0; i < KLSMPTE2064_AUDIO_INPUT_CHANNELS_MAX; i++) {
+		column[i] = -1;
+	}
+
+	memset(plan, 0, sizeof(*plan));
+	for (uint32_t p = 0; p < ctx->programCount; p++) {
+		const struct klsmpte2064_audio_program_s *prg = &ctx->programs[p];
+		for (uint32_t c = 0; c < prg->channelCount; c++) {
+			uint32_t ch = prg->channels[c];
+			if (ch >= channelCount) {
+				plan->loader = NULL;
+				return -EINVAL;
+			}
+			if (column[ch] < 0) {
+				column[ch] = plan->usedCount;
+				plan->used[plan->usedCount++] = ch;
+			}
+			plan->matrix[p][column[ch]] += prg->coefficients[c];
+		}
+	}
+
+	plan->format = format;
+	plan->planar = planar;
+	plan->channelCount = channelCount;
+
+	switch (format) {
+	case SAMPLEFORMAT_S16:   plan->loader = planar ? _downmix_load_s16p   : _downmix_load_s16;   break;
+	case SAMPLEFORMAT_S24LE: plan->loader = planar ? _downmix_load_s24lep : _downmix_load_s24le; break;
+	case SAMPLEFORMAT_S24BE: plan->loader = planar ? _downmix_load_s24bep : _downmix_load_s24be; break;
+	case SAMPLEFORMAT_S32:   plan->loader = planar ? _downmix_load_s32p   : _downmix_load_s32;   break;
+	default:
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/* Decimate count mono samples by factor with a triangular kernel, 1 2 .. factor .. 2 1,
+ * normalized to unity gain. Input at phase p contributes (factor - 1 - p) to the current
+ * output and (p + 1) to the next, two multiply-adds per input sample. out may equal in,
+ * outputs are never written ahead of the input being read.
+ * Returns the number of samples written to out.
+ */
+uint32_t klsmpte2064_audio_decimate(struct audio_decimate_s *d, uint32_t factor, const float *in, uint32_t count, float *out)
+{
+	const float gain = 1.0f / (float)(factor * factor);
+	uint32_t n = 0;
+
+	for (uint32_t i = 0; i < count; i++) {
+		float x = in[i];
+		d->cur += (float)(factor - 1 - d->phase) * x;
+		d->next += (float)(d->phase + 1) * x;
+
+		if (++d->phase == factor) {
+			out[n++] = d->cur * gain;
+			d->cur = d->next;
+			d->next = 0;
+			d->phase = 0;
+		}
+	}
+
+	return n;
+}
+
+/* Downmix every program into programBuf, reading each referenced input sample once.
+ * Full scale input samples are counted into each programs audio_clips.
+ * When the context decimates, each block is decimated while it's still in cache,
+ * so the full rate mix never reaches programBuf.
+ * Returns the number of samples per program in programBuf.
+ */
+uint32_t klsmpte2064_downmix_run(struct ctx_s *ctx, const void *planes[], uint32_t sampleCount)
+{
+	const struct downmix_plan_s *plan = &ctx->downmix;
+	float rows[KLSMPTE2064_AUDIO_INPUT_CHANNELS_MAX * DOWNMIX_BLOCK];
+	float mix[DOWNMIX_BLOCK];
+	uint32_t clips[KLSMPTE2064_AUDIO_INPUT_CHANNELS_MAX] = { 0 };
+	uint32_t written = 0;
+
+	for (uint32_t offset = 0; offset < sampleCount; offset += DOWNMIX_BLOCK) {
+		uint32_t count = sampleCount - offset;
+		if (count > DOWNMIX_BLOCK) {
+			count = DOWNMIX_BLOCK;
+		}
+
+		plan->loader(plan, planes, offset, count, rows, clips);
+
+		/* Programs share a decimation phase, they're always reset together */
+		uint32_t n = 0;
+		for (uint32_t p = 0; p < ctx->programCount; p++) {
+			float *prg = ctx->programBuf + (p * ctx->audioMaxSampleCount);
+			float *out = ctx->decimate > 1 ? mix : prg + offset;
+			memset(out, 0, count * sizeof(float));
+			for (uint32_t u = 0; u < plan->usedCount; u++) {
+				if (plan->matrix[p][u] != 0.0f) {
+					_downmix_madd(out, rows + (u * DOWNMIX_BLOCK), plan->matrix[p][u], count);
+				}
+			}
+			if (ctx->decimate > 1) {
+				n = klsmpte2064_audio_decimate(&ctx->decim[AFP_SLOT_PROGRAM(p)], ctx->decimate, mix, count, prg + written);
+			} else {
+				n = count;
+			}
+		}
+		written += n;
+	}
+
+	/* Clipping is per input channel, charge it to every program mixing the channel */
+	for (uint32_t p = 0; p < ctx->programCount; p++) {
+		for (uint32_t u = 0; u < plan->usedCount; u++) {
+			if (plan->matrix[p][u] != 0.0f) {
+				ctx->audio_clips[AFP_SLOT_PROGRAM(p)] += clips[u];
+			}
+		}
+	}
+
+	return written;
+}
@@ -6,6 +6,100 @@
 #include <stdlib.h>
 #include <string.h>
 
+/* Take a copy of the most recent video fingerprints, see 6.3 */
+void klsmpte2064_frame_capture_video(struct ctx_s *ctx, struct fp_frame_s *f)
+{
+	if (ctx->progressive) {
+		f->vfp[0] = ctx->video_fingerprint_data_f4; /* Current frame */
+		f->vfp_count = 1;
+	} else {
+		/* Both fields of the current frame were processed, field 1 is now f3 */
+		f->vfp[0] = ctx->video_fingerprint_data_f3; /* Field 1 */
+		f->vfp[1] = ctx->video_fingerprint_data_f4; /* Field 2 */
+		f->vfp_count = 2;
+	}
+	/* Video fingerprints are only valid once we have enough history, see 5.2.3.1.
+	 * A resync frame was reseeded from real content, it needn't wait for the count.
+	 */
+	f->flags = ctx->video_flags;
+	f->video_ready = ctx->fingerprints_calculated >= 3 || (f->flags & KLSMPTE2064_CONTAINER_RESYNC);
+	if (f->flags & KLSMPTE2064_CONTAINER_DISCONTINUITY) {
+		f->video_ready = 0;
+	}
+}
+
+/* Take a copy of the most recent audio fingerprint for a specific type or program slot */
+void klsmpte2064_frame_capture_audio(struct ctx_s *ctx, int slot, struct fp_frame_s *f)
+{
+	uint32_t len = klbs_get_byte_count(&ctx->fp_bs[slot]);
+	if (len > sizeof(f->afp[slot])) {
+		len = sizeof(f->afp[slot]);
+	}
+	memcpy(&f->afp[slot][0], &ctx->fp_buffer[slot][0], len);
+	f->afp_len[slot] = len;
+	f->afp_mixtype[slot] = ctx->afp_mixtype[slot];
+	if (len) {
+		f->audio_mask |= (1 << slot);
+	} else {
+		f->audio_mask &= ~(1 << slot);
+	}
+}
+
+/* Called by the video push thread once a frame is complete */
+void klsmpte2064_publish_video(struct ctx_s *ctx)
+{
+	seqlock_write_begin(&ctx->video_pub_seq);
+	klsmpte2064_frame_capture_video(ctx, &ctx->video_pub);
+	seqlock_write_end(&ctx->video_pub_seq);
+
+	if (ctx->emit) {
+		klsmpte2064_emit_video(ctx);
+	}
+}
+
+/* Called by the audio push thread once fingerprints are complete.
+ * All slots in the mask are published together.
+ */
+void klsmpte2064_publish_audio(struct ctx_s *ctx, uint32_t slotMask)
+{
+	seqlock_write_begin(&ctx->audio_pub_seq);
+	for (int i = 0; i < AFP_SLOTS; i++) {
+		if (slotMask & (1 << i)) {
+			klsmpte2064_frame_capture_audio(ctx, i, &ctx->audio_pub);
+			ctx->levels_pub[i] = ctx->levels[i];
+		}
+	}
+	seqlock_write_end(&ctx->audio_pub_seq);
+
+	if (ctx->emit) {
+		klsmpte2064_emit_audio(ctx, slotMask);
+	}
+}
+
+/* Merge the latest published video and audio into a single frame.
+ * Retries if either writer updated its snapshot during the copy.
+ */
+static void _snapshot_read(struct ctx_s *ctx, struct fp_frame_s *f)
+{
+	uint32_t seq;
+
+	do {
+		seq = seqlock_read_begin(&ctx->video_pub_seq);
+		f->video_ready = ctx->video_pub.video_ready;
+		f->flags = ctx->video_pub.flags;
+		f->vfp_count = ctx->video_pub.vfp_count;
+		memcpy(&f->vfp[0], &ctx->video_pub.vfp[0], sizeof(f->vfp));
+	} while (seqlock_read_retry(&ctx->video_pub_seq, seq));
+
+	do {
+		seq = seqlock_read_begin(&ctx->audio_pub_seq);
+		f->audio_mask = ctx->audio_pub.audio_mask;
+		memcpy(&f->afp_len[0], &ctx->audio_pub.afp_len[0], sizeof(f->afp_len));
+		memcpy(&f->afp[0][0], &ctx->audio_pub.afp[0][0], sizeof(f->afp));
+		memcpy(&f->afp_mixtype[0], &ctx->audio_pub.afp_mixtype[0], sizeof(f->afp_mixtype));
+	} while (seqlock_read_retry(&ctx->audio_pub_seq, seq));
+}
+
 /* 6.1 - Table 5 - Container structure */
 int klsmpte2064_encapsulation_pack(void *hdl, uint8_t *data, uint32_t len, uint32_t *usedLength)
 {
@@ -13,27 +107,17 @@ int klsmpte2064_encapsulation_pack(void *hdl, uint8_t *data, uint32_t len, uint3
 	if (!ctx || !data || len < 256) {
 		return -EINVAL;
 	}
-	if (ctx->fingerprints_calculated < 3) {
-		return -ENODATA;
-	}
-
-	int id_present_flag = 1;
-	int vfp_present_flag = 1;
-	int afp_present_flag = 0;
 
-	/* How many audio fingerprints do we have? */
-	for (int i = 0; i < AUDIOTYPE_MAX; i++) {
-		if (klbs_get_byte_count(&ctx->fp_bs[i]) > 0) {
-			afp_present_flag++;
-		}
+	/* Safe to call while other threads push audio and video */
+	struct fp_frame_s f;
+	memset(&f, 0, sizeof(f));
+	_snapshot_read(ctx, &f);
+	if (!f.video_ready && !(f.flags & KLSMPTE2064_CONTAINER_DISCONTINUITY)) {
+		return -ENODATA;
 	}
 
-	/* Never actually called out if reserved means its 0 or 1, we'll go with the mpeg standard of 1 */
-	uint32_t reserved = 0xffffffff;
-
-	klbs_write_set_buffer(ctx->bs, data, len);
-	klbs_write_bits(ctx->bs, 0x00, 8); /* FP_protocol_version */
-	klbs_write_bits(ctx->bs, ctx->sequence_counter++, 8); /* Sequence_Counter */
+	return klsmpte2064_encapsulation_pack_frame(ctx, &f, data, len, usedLength);
+}
 
 /* SMPTE S253 Picture_Rate
 | Value (binary) | Value (hex) | Frame Rate               |
@@ -50,116 +134,109 @@ int klsmpte2064_encapsulation_pack(void *hdl, uint8_t *data, uint32_t len, uint3
 | 1001–1111      | 0x9–0xF     | Reserved                 |
 */
 
-	klbs_write_bits(ctx->bs, 0, 8); /* Length: Come back and update this. */
-
-	klbs_write_bits(ctx->bs, 7, 4); /* Picture_Rate - hardcoded to 59.94 */
-	klbs_write_bits(ctx->bs, reserved, 1); /* Reserved */
-	klbs_write_bits(ctx->bs, id_present_flag, 1); /* ID Present Flag */
-	klbs_write_bits(ctx->bs, vfp_present_flag, 1); /* VFp Present Flag */
-	klbs_write_bits(ctx->bs, afp_present_flag, 1); /* AFp Prsent Flag */
-
-	if (id_present_flag) {
-		klbs_write_bits(ctx->bs, reserved, 5); /* Reserved */
-		klbs_write_bits(ctx->bs, 0, 3); /* SCType: 0 = ID Sub Container  */
-		klbs_write_bits(ctx->bs, reserved, 3); /* Reserved */
-		klbs_write_bits(ctx->bs, 2, 5); /* Length of ID Data */
-		klbs_write_bits(ctx->bs, 'K', 8); /* Arbitrary data */
-		klbs_write_bits(ctx->bs, 'L', 8); /* Arbitrary data */
+/* Build the parts of the container that are fixed for the life of the context,
+ * the Table 5 header and the ID sub container. Every field in the container is
+ * byte aligned, so each pack is a copy of this template, a few patched bytes and
+ * the fingerprints appended.
+ */
+void klsmpte2064_encapsulation_init(struct ctx_s *ctx)
+{
+	/* Contexts allocated without a frame rate have always reported 59.94 */
+	uint8_t picture_rate = ctx->frame_rate ? ctx->frame_rate : FRAMERATE_59_94;
+
+	/* Never actually called out if reserved means its 0 or 1, we'll go with the mpeg standard of 1 */
+	uint8_t *t = &ctx->container_template[0];
+	t[0] = 0x00; /* FP_protocol_version */
+	t[1] = 0x00; /* Sequence_Counter, patched */
+	t[2] = 0x00; /* Length, patched */
+	t[3] = (picture_rate << 4) | (1 << 3) /* Reserved */ | (1 << 2) /* ID Present Flag, VFp and AFp patched */;
+	t[4] = (0x1f << 3) | 0; /* Reserved, SCType: 0 = ID Sub Container */
+	t[5] = (0x07 << 5) | 2; /* Reserved, Length of ID Data, patched when status is carried */
+	t[6] = 'K'; /* Arbitrary data */
+	t[7] = 'L'; /* Arbitrary data */
+}
+
+/* Serialize a single frames worth of fingerprints into a container */
+int klsmpte2064_encapsulation_pack_frame(struct ctx_s *ctx, const struct fp_frame_s *f, uint8_t *data, uint32_t len, uint32_t *usedLength)
+{
+	int vfp_present_flag = f->video_ready;
+	int afp_count = 0;
+
+	/* How many audio fingerprints do we have? */
+	for (int i = 0; i < AFP_SLOTS; i++) {
+		if (f->afp_len[i] > 0) {
+			afp_count++;
+		}
+	}
+
+	/* Worst case, every sub container full */
+	if (len < CONTAINER_TEMPLATE_SIZE + 1 + 3 + 1 + (AFP_SLOTS * 10) + 1) {
+		return -EINVAL;
+	}
+
+	memcpy(data, &ctx->container_template[0], CONTAINER_TEMPLATE_SIZE);
+	data[1] = ctx->sequence_counter++; /* Sequence_Counter */
+	data[3] |= (vfp_present_flag << 1) | (afp_count ? 1 : 0); /* VFp Present Flag, AFp Present Flag */
+	uint32_t n = CONTAINER_TEMPLATE_SIZE;
+
+	if (f->flags) {
+		data[5] = (0x07 << 5) | 3; /* Length of ID Data */
+		data[n++] = f->flags; /* KLSMPTE2064_CONTAINER_* */
 	}
 
 	if (vfp_present_flag) {
-		klbs_write_bits(ctx->bs, reserved, 3); /* Reserved */
-		if (ctx->progressive) {
-			klbs_write_bits(ctx->bs, 1, 2); /* VF Data Count - 6.3 */
-			klbs_write_bits(ctx->bs, 1, 3); /* SCType: 1 = ID Video Fingerprint Container  */
-			klbs_write_bits(ctx->bs, ctx->video_fingerprint_data_f4, 8); /* Video Fingerprint Data - Current frame */
-		} else {
-			klbs_write_bits(ctx->bs, 2, 2); /* VF Data Count - 6.3 */
-			klbs_write_bits(ctx->bs, 1, 3); /* SCType: 1 = ID Video Fingerprint Container  */
-			klbs_write_bits(ctx->bs, ctx->video_fingerprint_data_f4, 8); /* Video Fingerprint Data */
-			klbs_write_bits(ctx->bs, ctx->video_fingerprint_data_f2, 8); /* Video Fingerprint Data */
+		/* Reserved, VF Data Count - 6.3, 1 per frame or 2 per interlaced frame, SCType: 1 = Video Fingerprint Container */
+		data[n++] = (0x07 << 5) | (f->vfp_count << 3) | 0x01;
+		for (int i = 0; i < f->vfp_count; i++) {
+			data[n++] = f->vfp[i]; /* Video Fingerprint Data - Frame or field 1, then field 2 */
 		}
 	}
 
-	if (afp_present_flag) {
-		/* Unsupported */
-
-		/* Each call to klsmpte2064_audio_push() gets it own audio fingerprint.
-		 * This enables callers to fingerprint the various audio channels
+	if (afp_count) {
+		/* Each audio type pushed via klsmpte2064_audio_push(), and each
+		 * program configured via klsmpte2064_audio_set_programs(), gets its own
+		 * audio fingerprint. This enables callers to fingerprint the various audio channels
 		 * in way they deem necessary:
 		 * Eg. 1. English stereo downmix
 		 *     2. Spanish stereo downmix.
 		 *     3. English 5.1 downmix.
 		 * 
-		 * Callers are expected to call audio push as many times as they need for the same data,
+		 * Programs are computed in a single pass over the interleaved audio,
 		 * each getting its own fingerprint, each encapsulated sequentially.
 		 * 
 		 * The length of a fingerprint in bits is no more than ctx->t3->decimator_factor
 		 * which the spec says is either 50 (6.25bytes) or 52 bits (6.5 bytes) exactly.
 		 * 
 		 */
-
-		klbs_write_bits(ctx->bs, afp_present_flag, 5); /* Audio Fingerprint Count */
-		klbs_write_bits(ctx->bs, 0x02, 3); /* SCType: 2 = ID Audio Fingerprint Container  */
+		data[n++] = (afp_count << 3) | 0x02; /* Audio Fingerprint Count, SCType: 2 = Audio Fingerprint Container */
 
 		uint8_t audio_fingerprint_id = 0;
-		for (int i = 0; i < AUDIOTYPE_MAX; i++) {
-			uint32_t len = klbs_get_byte_count(&ctx->fp_bs[i]);
-			if (len == 0) {
+		for (int i = 0; i < AFP_SLOTS; i++) {
+			uint32_t afp_len = f->afp_len[i];
+			if (afp_len == 0) {
 				continue;
 			}
 
-			klbs_write_bits(ctx->bs, audio_fingerprint_id++, 5);
-
-			/* AudioMixType */
-			switch (i) {
-			case AUDIOTYPE_STEREO_S16P:
-				klbs_write_bits(ctx->bs, 0x02, 3); /* Downmix from 2.0-channel audio */
-				break;
-			case AUDIOTYPE_STEREO_S32_CH16_DECKLINK:
-				klbs_write_bits(ctx->bs, 0x02, 3); /* Downmix from 2.0-channel audio */
-				break;
-			case AUDIOTYPE_SMPTE312_S32_CH16_DECKLINK:
-				klbs_write_bits(ctx->bs, 0x05, 3); /* Downmix from 5.1-channel audio */
-				break;
-			default:
-				klbs_write_bits(ctx->bs, 0x0, 3); /* Reserved for future use by SMPTE */
-			}
-
-			klbs_write_bits(ctx->bs, len, 5); /* AFDataCount */
-			klbs_write_bits(ctx->bs, reserved, 3); /* Reserved */
-
-			for (uint32_t j = 0; j < len; j++) {
-				klbs_write_bits(ctx->bs, ctx->fp_buffer[i][j], 8); /* Audio Fingerprint Data */
-			}
-
+			data[n++] = (audio_fingerprint_id++ << 3) | (f->afp_mixtype[i] & 0x07); /* AudioMixType */
+			data[n++] = (afp_len << 3) | 0x07; /* AFDataCount, Reserved */
+			memcpy(&data[n], &f->afp[i][0], afp_len); /* Audio Fingerprint Data */
+			n += afp_len;
 		}
 	}
 
-	uint32_t c = 0;
-	for (int i = 0; i < klbs_get_byte_count(ctx->bs); i++) {
-		c += *(data + i);
-	}
-	uint8_t checksum = (uint8_t)(-c & 0xFF);
-	klbs_write_bits(ctx->bs, checksum, 8); /* Checksum */
-
-	/* Verify it */
-	c = 0;
-	for (int i = 0; i < klbs_get_byte_count(ctx->bs); i++) {
-		c += *(data + i);
-	}
-	if ((c & 0xFF) != 0) {
-		fprintf(stderr, MODULE_PREFIX "warning, checksum failed verification. Continuing\n");
-	}
-
-	klbs_write_buffer_complete(ctx->bs);
-
-	/* Go back and patch the struct to reflext the packed length */
 	/* "length of the audio and video fingerprint container from the start of the FP_protocol_version
 	 *  field to the end of the Checksum field (inclusive)."
 	 */
-	*(data + 2) = klbs_get_byte_count(ctx->bs);
-	*usedLength = klbs_get_byte_count(ctx->bs);
+	data[2] = n + 1;
+
+	/* Checksum, all bytes including the checksum sum to zero */
+	uint8_t c = 0;
+	for (uint32_t i = 0; i < n; i++) {
+		c += data[i];
+	}
+	data[n++] = -c;
+
+	*usedLength = n;
 
 	return 0;
 }
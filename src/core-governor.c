@@ -0,0 +1,159 @@
+#include <libklsmpte2064/klsmpte2064.h>
+
+#include "core-private.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+/* Cost governor, sheds optional work when the pushes overrun their budget.
+ *
+ * The video push thread accumulates its own time, the audio pushes add
+ * theirs to a counter the video thread takes once per window, so the only
+ * shared write is one relaxed add per audio push. Decisions step a single
+ * level per window.
+ *
+ * The windowed prefilter is far cheaper than the full frame one, so a shed
+ * always drops the average under the low water mark. Restoring is therefore
+ * a probe: a restore that overruns in its first window doubles the hold
+ * before the next attempt, up to GOVERNOR_HOLD_MAX windows.
+ */
+
+#define GOVERNOR_HIGH_WATER 0.9
+#define GOVERNOR_LOW_WATER  0.5
+#define GOVERNOR_WINDOW     30
+#define GOVERNOR_HOLD_MAX   64
+
+uint64_t klsmpte2064_governor_clock(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static void _governor_apply(struct ctx_s *ctx, int level)
+{
+	/* The grids are identical either way, the fingerprints don't change */
+	ctx->wss_line_count = level >= GOVERNOR_LEVEL_WINDOWED ? WSS_ROWS * ctx->field_count : ctx->governor_line_count;
+	__atomic_store_n(&ctx->governor_level, level, __ATOMIC_RELAXED);
+}
+
+void klsmpte2064_governor_video(struct ctx_s *ctx, uint64_t start)
+{
+	const struct klsmpte2064_governor_params_s *p = &ctx->governor_params;
+
+	ctx->governor_video_ns += klsmpte2064_governor_clock() - start;
+	if (++ctx->governor_frames < p->window) {
+		return;
+	}
+
+	uint64_t audio_ns = __atomic_exchange_n(&ctx->governor_audio_ns, 0, __ATOMIC_RELAXED);
+	uint32_t averageUs = ((ctx->governor_video_ns + audio_ns) / ctx->governor_frames) / 1000;
+	__atomic_store_n(&ctx->governor_average_us, averageUs, __ATOMIC_RELAXED);
+	ctx->governor_frames = 0;
+	ctx->governor_video_ns = 0;
+	ctx->governor_since_restore++;
+
+	int previous = ctx->governor_level;
+	int level = previous;
+
+	if (averageUs > p->budgetUs * p->highWater) {
+		if (level < GOVERNOR_LEVEL_MAX - 1) {
+			level++;
+			/* Overrunning straight after a restore, wait longer next time */
+			if (ctx->governor_since_restore == 1) {
+				ctx->governor_backoff *= 2;
+				if (ctx->governor_backoff > GOVERNOR_HOLD_MAX) {
+					ctx->governor_backoff = GOVERNOR_HOLD_MAX;
+				}
+			} else {
+				ctx->governor_backoff = 1;
+			}
+			ctx->governor_hold = ctx->governor_backoff;
+		}
+	} else if (ctx->governor_hold) {
+		ctx->governor_hold--;
+	} else if (averageUs < p->budgetUs * p->lowWater && level > GOVERNOR_LEVEL_FULL) {
+		level--;
+		ctx->governor_since_restore = 0;
+	}
+
+	if (level == previous) {
+		return;
+	}
+
+	_governor_apply(ctx, level);
+
+	if (klsmpte2064_verbose(ctx)) {
+		printf(MODULE_PREFIX "governor level %d -> %d, %" PRIu32 "us per frame, budget %" PRIu32 "us\n",
+			previous, level, averageUs, p->budgetUs);
+	}
+	if (p->levelChange) {
+		p->levelChange(p->opaque, ctx, level, previous, averageUs);
+	}
+}
+
+int klsmpte2064_governor_enable(void *hdl, const struct klsmpte2064_governor_params_s *params)
+{
+	struct ctx_s *ctx = (struct ctx_s *)hdl;
+	if (!ctx) {
+		return -EINVAL;
+	}
+
+	/* Back to the configuration before any shedding */
+	if (ctx->governor_enabled) {
+		_governor_apply(ctx, GOVERNOR_LEVEL_FULL);
+	}
+	ctx->governor_enabled = 0;
+	ctx->governor_frames = 0;
+	ctx->governor_video_ns = 0;
+	ctx->governor_audio_ns = 0;
+	ctx->governor_average_us = 0;
+	ctx->governor_hold = 0;
+	ctx->governor_backoff = 1;
+	ctx->governor_since_restore = 1; /* Not just restored */
+
+	if (!params) {
+		return 0;
+	}
+	if (params->budgetUs == 0 || params->highWater < 0 || params->lowWater < 0) {
+		return -EINVAL;
+	}
+
+	struct klsmpte2064_governor_params_s *p = &ctx->governor_params;
+	*p = *params;
+	if (p->highWater == 0) {
+		p->highWater = GOVERNOR_HIGH_WATER;
+	}
+	if (p->lowWater == 0) {
+		p->lowWater = GOVERNOR_LOW_WATER;
+	}
+	if (p->lowWater >= p->highWater) {
+		return -EINVAL;
+	}
+	if (p->window == 0) {
+		p->window = GOVERNOR_WINDOW;
+	}
+
+	ctx->governor_line_count = ctx->wss_line_count;
+	ctx->governor_enabled = 1;
+
+	return 0;
+}
+
+int klsmpte2064_governor_query(void *hdl, enum klsmpte2064_governor_level_e *level, uint32_t *averageUs)
+{
+	struct ctx_s *ctx = (struct ctx_s *)hdl;
+	if (!ctx || !level) {
+		return -EINVAL;
+	}
+
+	*level = __atomic_load_n(&ctx->governor_level, __ATOMIC_RELAXED);
+	if (averageUs) {
+		*averageUs = __atomic_load_n(&ctx->governor_average_us, __ATOMIC_RELAXED);
+	}
+
+	return 0;
+}
@@ -0,0 +1,452 @@
+#define _GNU_SOURCE /* CPU_SET, pthread_setaffinity_np */
+
+#include <libklsmpte2064/klsmpte2064.h>
+
+#include "core-private.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
+
+/* Allocation policy.
+ *
+ * Every allocation made for a context goes through its allocator, malloc/free
+ * unless the caller supplied callbacks (Eg. an arena) via klsmpte2064_context_alloc_ex().
+ *
+ * The luma frames and audio working arrays hold nothing between push calls,
+ * they live in a scratch which the context binds at the start of each push.
+ * A context owns a private scratch, unless the caller shares one between all
+ * of the contexts serviced by a worker thread. Scratches grow to fit the largest
+ * context using them, failures are reported as -ENOMEM, never fatal.
+ *
+ * Luma frames can optionally be placed, mapped with huge pages and/or bound
+ * to a NUMA node. mbind/set_mempolicy are issued as raw syscalls so there's
+ * no dependency on libnuma.
+ */
+
+#define HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+/* From linux/mempolicy.h */
+#define MEMPOLICY_PREFERRED 1
+#define MEMPOLICY_BIND 2
+#define MEMPOLICY_MF_MOVE (1 << 1)
+#define NUMA_NODES_MAX 1024
+
+static void *_mem_default_alloc(void *opaque, size_t size)
+{
+	return malloc(size);
+}
+
+static void _mem_default_free(void *opaque, void *ptr)
+{
+	free(ptr);
+}
+
+static const struct klsmpte2064_allocator_s _mem_default = {
+	.alloc = _mem_default_alloc,
+	.free = _mem_default_free,
+	.opaque = NULL,
+};
+
+/* The callers allocator, or malloc/free */
+const struct klsmpte2064_allocator_s *klsmpte2064_mem_allocator(const struct klsmpte2064_allocator_s *allocator)
+{
+	return allocator ? allocator : &_mem_default;
+}
+
+void *klsmpte2064_mem_alloc(const struct klsmpte2064_allocator_s *allocator, size_t size)
+{
+	return allocator->alloc(allocator->opaque, size);
+}
+
+void klsmpte2064_mem_free(const struct klsmpte2064_allocator_s *allocator, void *ptr)
+{
+	if (ptr) {
+		allocator->free(allocator->opaque, ptr);
+	}
+}
+
+/* CACHELINE_SIZE aligned, whatever alignment the allocator provides.
+ * The pointer the allocator returned is kept just before the aligned block.
+ */
+void *klsmpte2064_mem_alloc_aligned(const struct klsmpte2064_allocator_s *allocator, size_t size)
+{
+	uint8_t *raw = klsmpte2064_mem_alloc(allocator, size + CACHELINE_SIZE + sizeof(void *));
+	if (!raw) {
+		return NULL;
+	}
+
+	uintptr_t p = ((uintptr_t)raw + sizeof(void *) + CACHELINE_SIZE - 1) & ~((uintptr_t)CACHELINE_SIZE - 1);
+	((void **)p)[-1] = raw;
+
+	return (void *)p;
+}
+
+void klsmpte2064_mem_free_aligned(const struct klsmpte2064_allocator_s *allocator, void *ptr)
+{
+	if (ptr) {
+		klsmpte2064_mem_free(allocator, ((void **)ptr)[-1]);
+	}
+}
+
+int klsmpte2064_scratch_alloc(void **scratch, const struct klsmpte2064_allocator_s *allocator)
+{
+	if (!scratch) {
+		return -EINVAL;
+	}
+	if (!allocator) {
+		allocator = &_mem_default;
+	}
+	if (!allocator->alloc || !allocator->free) {
+		return -EINVAL;
+	}
+
+	struct scratch_s *s = klsmpte2064_mem_alloc(allocator, sizeof(*s));
+	if (!s) {
+		return -ENOMEM;
+	}
+	memset(s, 0, sizeof(*s));
+	s->allocator = *allocator;
+
+	*scratch = s;
+	return 0;
+}
+
+static void _scratch_free_audio(struct scratch_s *s)
+{
+	klsmpte2064_mem_free_aligned(&s->allocator, s->bufA);
+	klsmpte2064_mem_free_aligned(&s->allocator, s->Es);
+	klsmpte2064_mem_free_aligned(&s->allocator, s->Ms);
+	klsmpte2064_mem_free_aligned(&s->allocator, s->comp_bit);
+	klsmpte2064_mem_free_aligned(&s->allocator, s->result);
+	s->bufA = s->Es = s->Ms = NULL;
+	s->comp_bit = s->result = NULL;
+	s->audio_samples = 0;
+}
+
+static void _scratch_free_programs(struct scratch_s *s)
+{
+	klsmpte2064_mem_free_aligned(&s->allocator, s->programBuf);
+	s->programBuf = NULL;
+	s->audio_programs = 0;
+}
+
+static void _scratch_free_batch(struct scratch_s *s)
+{
+	klsmpte2064_mem_free_aligned(&s->allocator, s->batch_x);
+	klsmpte2064_mem_free_aligned(&s->allocator, s->batch_comp);
+	s->batch_x = NULL;
+	s->batch_comp = NULL;
+	s->batch_samples = 0;
+}
+
+/* Does /sys know about this node */
+static int _numa_node_valid(int node)
+{
+	char path[64];
+	if (node < 0 || node >= NUMA_NODES_MAX) {
+		return 0;
+	}
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", node);
+	return access(path, F_OK) == 0;
+}
+
+static size_t _luma_map_length(size_t size)
+{
+	return (size + HUGEPAGE_SIZE - 1) & ~((size_t)HUGEPAGE_SIZE - 1);
+}
+
+/* Map a luma frame per the scratch placement. Without reserved huge pages
+ * the mapping is trimmed to a 2MB boundary, so transparent huge pages can back it.
+ */
+static void *_luma_map(struct scratch_s *s, size_t size)
+{
+	size_t len = _luma_map_length(size);
+	uint8_t *p = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+	if (s->placement & KLSMPTE2064_PLACEMENT_HUGEPAGES) {
+		p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	}
+#endif
+	if (p == MAP_FAILED) {
+		uint8_t *raw = mmap(NULL, len + HUGEPAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (raw == MAP_FAILED) {
+			return NULL;
+		}
+		p = (uint8_t *)(((uintptr_t)raw + HUGEPAGE_SIZE - 1) & ~((uintptr_t)HUGEPAGE_SIZE - 1));
+		if (p > raw) {
+			munmap(raw, p - raw);
+		}
+		munmap(p + len, (raw + len + HUGEPAGE_SIZE) - (p + len));
+#ifdef MADV_HUGEPAGE
+		if (s->placement & KLSMPTE2064_PLACEMENT_HUGEPAGES) {
+			madvise(p, len, MADV_HUGEPAGE);
+		}
+#endif
+	}
+
+#ifdef __linux__
+	/* Bind before first touch, so every page is faulted in on the node */
+	if (s->placement & KLSMPTE2064_PLACEMENT_NUMA) {
+		unsigned long mask[NUMA_NODES_MAX / (8 * sizeof(unsigned long))] = { 0 };
+		mask[s->numa_node / (8 * sizeof(unsigned long))] |= 1UL << (s->numa_node % (8 * sizeof(unsigned long)));
+		if (syscall(SYS_mbind, p, len, MEMPOLICY_BIND, mask, NUMA_NODES_MAX, MEMPOLICY_MF_MOVE) < 0) {
+			munmap(p, len);
+			return NULL;
+		}
+	}
+#endif
+
+	return p;
+}
+
+static void _luma_free(struct scratch_s *s, uint8_t *buf, size_t size)
+{
+	if (!buf) {
+		return;
+	}
+	if (s->placement) {
+		munmap(buf, _luma_map_length(size));
+	} else {
+		klsmpte2064_mem_free(&s->allocator, buf);
+	}
+}
+
+void klsmpte2064_scratch_free(void *scratch)
+{
+	struct scratch_s *s = (struct scratch_s *)scratch;
+	if (!s) {
+		return;
+	}
+
+	_luma_free(s, s->y, s->luma_size);
+	_luma_free(s, s->y_csc, s->luma_csc_size);
+	_scratch_free_audio(s);
+	_scratch_free_programs(s);
+	_scratch_free_batch(s);
+
+	struct klsmpte2064_allocator_s allocator = s->allocator;
+	klsmpte2064_mem_free(&allocator, s);
+}
+
+/* Grow a luma frame to at least size bytes, contents are not preserved */
+static int _luma_grow(struct scratch_s *s, uint8_t **buf, size_t *cur, size_t size)
+{
+	if (size <= *cur) {
+		return 0;
+	}
+
+	_luma_free(s, *buf, *cur);
+	*cur = 0;
+	if (s->placement) {
+		*buf = _luma_map(s, size);
+	} else {
+		*buf = klsmpte2064_mem_alloc(&s->allocator, size);
+	}
+	if (!*buf) {
+		return -ENOMEM;
+	}
+	*cur = size;
+
+	return 0;
+}
+
+int klsmpte2064_scratch_set_placement(void *scratch, uint32_t flags, int numaNode)
+{
+	struct scratch_s *s = (struct scratch_s *)scratch;
+	if (!s || (flags & ~(KLSMPTE2064_PLACEMENT_HUGEPAGES | KLSMPTE2064_PLACEMENT_NUMA))) {
+		return -EINVAL;
+	}
+	if (s->y || s->y_csc) {
+		return -EBUSY;
+	}
+#ifndef __linux__
+	if (flags) {
+		return -EOPNOTSUPP;
+	}
+#endif
+	if ((flags & KLSMPTE2064_PLACEMENT_NUMA) && !_numa_node_valid(numaNode)) {
+		return -EINVAL;
+	}
+
+	s->placement = flags;
+	s->numa_node = numaNode;
+
+	return 0;
+}
+
+int klsmpte2064_thread_set_numa_node(int numaNode)
+{
+#ifdef __linux__
+	if (!_numa_node_valid(numaNode)) {
+		return -EINVAL;
+	}
+
+	/* cpulist is a range list, Eg. 0-15,32-47 */
+	char path[64], list[1024];
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", numaNode);
+	FILE *fh = fopen(path, "r");
+	if (!fh) {
+		return -errno;
+	}
+	if (!fgets(list, sizeof(list), fh)) {
+		fclose(fh);
+		return -EIO;
+	}
+	fclose(fh);
+
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	char *p = list;
+	while (*p && *p != '\n') {
+		char *end;
+		long lo = strtol(p, &end, 10), hi = lo;
+		if (end == p) {
+			break;
+		}
+		if (*end == '-') {
+			p = end + 1;
+			hi = strtol(p, &end, 10);
+		}
+		for (long c = lo; c <= hi && c < CPU_SETSIZE; c++) {
+			CPU_SET(c, &cpus);
+		}
+		p = (*end == ',') ? end + 1 : end;
+	}
+	if (CPU_COUNT(&cpus) == 0) {
+		return -EINVAL; /* Memory only node */
+	}
+
+	int r = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+	if (r) {
+		return -r;
+	}
+
+	unsigned long mask[NUMA_NODES_MAX / (8 * sizeof(unsigned long))] = { 0 };
+	mask[numaNode / (8 * sizeof(unsigned long))] |= 1UL << (numaNode % (8 * sizeof(unsigned long)));
+	if (syscall(SYS_set_mempolicy, MEMPOLICY_PREFERRED, mask, NUMA_NODES_MAX) < 0) {
+		return -errno;
+	}
+
+	return 0;
+#else
+	return -EOPNOTSUPP;
+#endif
+}
+
+int klsmpte2064_scratch_reserve_video(struct scratch_s *s, size_t lumaSize, size_t lumaCscSize)
+{
+	if (_luma_grow(s, &s->y, &s->luma_size, lumaSize) < 0) {
+		return -ENOMEM;
+	}
+	if (_luma_grow(s, &s->y_csc, &s->luma_csc_size, lumaCscSize) < 0) {
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+int klsmpte2064_scratch_reserve_audio(struct scratch_s *s, uint32_t samples, uint32_t programs)
+{
+	if (samples > s->audio_samples) {
+		_scratch_free_audio(s);
+		s->bufA = klsmpte2064_mem_alloc_aligned(&s->allocator, samples * sizeof(float));
+		s->Es = klsmpte2064_mem_alloc_aligned(&s->allocator, samples * sizeof(float));
+		s->Ms = klsmpte2064_mem_alloc_aligned(&s->allocator, samples * sizeof(float));
+		s->comp_bit = klsmpte2064_mem_alloc_aligned(&s->allocator, samples * sizeof(uint8_t));
+		s->result = klsmpte2064_mem_alloc_aligned(&s->allocator, samples * sizeof(uint8_t));
+		if (!s->bufA || !s->Es || !s->Ms || !s->comp_bit || !s->result) {
+			_scratch_free_audio(s);
+			return -ENOMEM;
+		}
+		s->audio_samples = samples;
+
+		/* Program buffers are strided by audio_samples */
+		_scratch_free_programs(s);
+	}
+
+	if (programs > s->audio_programs) {
+		_scratch_free_programs(s);
+		s->programBuf = klsmpte2064_mem_alloc_aligned(&s->allocator, programs * s->audio_samples * sizeof(float));
+		if (!s->programBuf) {
+			return -ENOMEM;
+		}
+		s->audio_programs = programs;
+	}
+
+	return 0;
+}
+
+int klsmpte2064_scratch_reserve_batch(struct scratch_s *s, uint32_t samples)
+{
+	if (samples > s->batch_samples) {
+		_scratch_free_batch(s);
+		s->batch_x = klsmpte2064_mem_alloc_aligned(&s->allocator, samples * AUDIO_BATCH_LANES * sizeof(float));
+		s->batch_comp = klsmpte2064_mem_alloc_aligned(&s->allocator, samples * AUDIO_BATCH_LANES * sizeof(uint8_t));
+		if (!s->batch_x || !s->batch_comp) {
+			_scratch_free_batch(s);
+			return -ENOMEM;
+		}
+		s->batch_samples = samples;
+	}
+
+	return 0;
+}
+
+/* Allocate the context and its private scratch, if either scratch isn't shared */
+int klsmpte2064_context_mem_alloc(struct ctx_s **out, const struct klsmpte2064_context_params_s *params)
+{
+	const struct klsmpte2064_allocator_s *allocator = &_mem_default;
+	if (params && params->allocator) {
+		allocator = params->allocator;
+	}
+	if (!allocator->alloc || !allocator->free) {
+		return -EINVAL;
+	}
+
+	/* Neighbouring contexts, pushed from different cores, never share a line */
+	struct ctx_s *ctx = klsmpte2064_mem_alloc_aligned(allocator, sizeof(*ctx));
+	if (!ctx) {
+		return -ENOMEM;
+	}
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->allocator = *allocator;
+
+	ctx->video_scratch = params ? params->videoScratch : NULL;
+	ctx->audio_scratch = params ? params->audioScratch : NULL;
+	if (!ctx->video_scratch || !ctx->audio_scratch) {
+		int r = klsmpte2064_scratch_alloc((void **)&ctx->private_scratch, allocator);
+		if (r == 0 && !ctx->video_scratch && params) {
+			r = klsmpte2064_scratch_set_placement(ctx->private_scratch, params->placement, params->numaNode);
+		}
+		if (r < 0) {
+			klsmpte2064_scratch_free(ctx->private_scratch);
+			klsmpte2064_mem_free_aligned(allocator, ctx);
+			return r;
+		}
+		if (!ctx->video_scratch) {
+			ctx->video_scratch = ctx->private_scratch;
+		}
+		if (!ctx->audio_scratch) {
+			ctx->audio_scratch = ctx->private_scratch;
+		}
+	}
+
+	*out = ctx;
+	return 0;
+}
+
+void klsmpte2064_context_mem_free(struct ctx_s *ctx)
+{
+	klsmpte2064_scratch_free(ctx->private_scratch);
+
+	struct klsmpte2064_allocator_s allocator = ctx->allocator;
+	klsmpte2064_mem_free_aligned(&allocator, ctx);
+}
@@ -5,6 +5,9 @@
 
 #include "klbitstream_readwriter.h"
 
+#include <pthread.h>
+#include <stddef.h>
+
 #define MODULE_PREFIX "libklsmpte2064: "
 
 struct tbl1_s
@@ -41,17 +44,159 @@ struct tbl3_s
 	int bitrate_per_second;
 	uint32_t timebase_num;
 	uint32_t timebase_den;
+	enum klsmpte2064_frame_rate_e picture_rate; /* SMPTE ST 253 code */
 };
 const struct tbl3_s *lookupTable3(double video_frame_rate);
+const struct tbl3_s *lookupTable3PictureRate(enum klsmpte2064_frame_rate_e rate);
+
+/* Table 3 and the detector coefficients are specified at 48KHz,
+ * other input rates are scaled relative to this.
+ */
+#define AUDIO_SAMPLE_RATE 48000
+
+/* Triangular (order 2 CIC) polyphase decimator state, one per mono stream.
+ * Each input contributes to the current and the next output, so only two
+ * accumulators are carried between blocks and frames.
+ */
+struct audio_decimate_s
+{
+	uint32_t phase; /* Input position within the current output, 0 .. factor - 1 */
+	float cur;
+	float next;
+};
+
+/* Audio fingerprint slots. The first AUDIOTYPE_MAX are indexed by
+ * klsmpte2064_audio_type_e, one per type pushed via klsmpte2064_audio_push().
+ * The remainder hold one fingerprint per program, see klsmpte2064_audio_set_programs().
+ * The container allows no more than 31 audio fingerprints.
+ */
+#define AFP_SLOT_PROGRAM(n) (AUDIOTYPE_MAX + (n))
+#define AFP_SLOTS AFP_SLOT_PROGRAM(KLSMPTE2064_AUDIO_PROGRAMS_MAX)
+
+/* A single frames worth of fingerprints, ready for encapsulation. */
+struct fp_frame_s
+{
+	int64_t pts; /* 90KHz clock, only used by the alignment buffer */
+	int video_ready;
+	uint8_t flags; /* KLSMPTE2064_CONTAINER_* */
+	uint8_t vfp[2]; /* Frame, or field 1 and field 2 */
+	int vfp_count;
+	uint32_t audio_mask; /* Bitmask of slots with valid afp */
+	uint8_t afp[AFP_SLOTS][8];
+	uint32_t afp_len[AFP_SLOTS];
+	uint8_t afp_mixtype[AFP_SLOTS]; /* AudioMixType, Table 10 */
+};
+
+/* Audio programs compiled for a specific input layout, see core-downmix.c */
+struct downmix_plan_s
+{
+	enum klsmpte2064_sample_format_e format;
+	int planar;
+	uint32_t channelCount;
+	uint32_t usedCount; /* Input channels referenced by at least one program */
+	uint32_t used[KLSMPTE2064_AUDIO_INPUT_CHANNELS_MAX];
+	float matrix[KLSMPTE2064_AUDIO_PROGRAMS_MAX][KLSMPTE2064_AUDIO_INPUT_CHANNELS_MAX]; /* [program][used] */
+
+	/* Format and layout specialised, converts a block of used channels to float rows */
+	void (*loader)(const struct downmix_plan_s *plan, const void *planes[], uint32_t offset, uint32_t count, float *rows,
+		uint32_t *clips);
+};
+
+/* Working memory that holds no state between push calls, see core-memory.c.
+ * Owned by a context, or shared by every context a worker thread services.
+ */
+struct scratch_s
+{
+	struct klsmpte2064_allocator_s allocator;
+
+	/* Video, mapped directly rather than allocated when placement is set */
+	uint32_t placement; /* KLSMPTE2064_PLACEMENT_ flags */
+	int numa_node;
+	size_t luma_size;
+	uint8_t *y;
+	size_t luma_csc_size;
+	uint8_t *y_csc;
+
+	/* Audio, each array holds audio_samples, cache line aligned */
+	uint32_t audio_samples;
+	float *bufA;
+	float *Es;
+	float *Ms;
+	uint8_t *comp_bit;
+	uint8_t *result;
+	uint32_t audio_programs;
+	float *programBuf; /* audio_programs * audio_samples */
+
+	/* klsmpte2064_audio_push_batch() lanes, sample major: [sample][lane] */
+#define AUDIO_BATCH_LANES 8
+	uint32_t batch_samples;
+	float *batch_x;
+	uint8_t *batch_comp;
+};
+
+/* Single writer sequence lock, see ctx_s. The writer makes seq odd while
+ * it updates the protected data, readers retry until they observe the same
+ * even seq before and after their copy. Writers never wait on readers.
+ */
+static inline void seqlock_write_begin(uint32_t *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void seqlock_write_end(uint32_t *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t seqlock_read_begin(const uint32_t *seq)
+{
+	uint32_t s;
+	while ((s = __atomic_load_n(seq, __ATOMIC_ACQUIRE)) & 1)
+		;
+	return s;
+}
+
+static inline int seqlock_read_retry(const uint32_t *seq, uint32_t s)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(seq, __ATOMIC_RELAXED) != s;
+}
 
+/* Contexts are allocated cache line aligned, see klsmpte2064_mem_alloc_aligned().
+ * 128 bytes, the line pair x86 prefetches together and the line size on
+ * Apple silicon and POWER.
+ */
+#define CACHELINE_SIZE 128
+#define CACHELINE_ALIGNED __attribute__((aligned(CACHELINE_SIZE)))
+
+/* The context is split into halves owned by the thread calling
+ * klsmpte2064_video_push(), the thread calling klsmpte2064_audio_push(),
+ * and the thread calling klsmpte2064_encapsulation_pack(). Those threads
+ * may differ. Video and audio publish their finished fingerprints into
+ * video_pub/audio_pub under a sequence lock, the pack step only ever reads
+ * those snapshots, so no push path waits on another.
+ *
+ * Each owner's fields start on their own cache line, so threads writing one
+ * region never invalidate lines another thread is reading. Configuration that
+ * is only read once the context is set up sits at the front, shared read only.
+ */
 struct ctx_s
 {
+	/* Configuration - read only once allocated, or changed with the pushes idle */
     int verbose;
-    
-	/* */
-	enum klsmpte2064_colorspace_e colorspace; // 1 = YUV420P, 2 = V210
-	uint8_t *y_csc; 
-	uint8_t *y; 
+
+	/* Memory, see core-memory.c. The scratch pointers below (y, y_csc, bufA, Es, Ms,
+	 * comp_bit, result, programBuf) are bound from these at the start of each push.
+	 */
+	struct klsmpte2064_allocator_s allocator;
+	struct scratch_s *video_scratch;
+	struct scratch_s *audio_scratch;
+	struct scratch_s *private_scratch; /* Owned, when either of the above isn't shared */
+
+	enum klsmpte2064_colorspace_e colorspace;
+	/* Colorspace specific luma reader and prefilter, writes 8 bit luma into y */
+	int (*prefilter)(struct ctx_s *ctx, const uint8_t *luma, int src_stride);
 	uint32_t ystride;
 	uint32_t width;
 	uint32_t height;
@@ -61,42 +206,107 @@ struct ctx_s
 
 	const struct tbl1_s *t1;
 	const struct tbl2_s *t2;
-	const struct tbl3_s *t3;
+
+    int per_pixel_motion_threshold;
+    enum klsmpte2064_motion_compare_e motion_compare;
+    /* Count pixels whose absolute difference is >= threshold, see core-video.c */
+    int (*motion_count)(const uint8_t *a, const uint8_t *b, int count, int threshold);
 
     /* 5.2.2 Windowing Sub-Sampling */
 #define WSS_ROWS 16
 #define WSS_SAMPLES_PER_ROW 60
 #define WSS_SAMPLES_PER_FRAME (WSS_ROWS * WSS_SAMPLES_PER_ROW)
+
+	/* The window subsamples an image based on 16 lines.
+	 * Cache those line numebrs that are specific to resolution.
+	 * Interlaced frames carry two fields, 16 lines each, so up to 32 lines.
+	 */
+	int wss_lines[WSS_ROWS * 2];
+	int wss_line_count;
+
+	/* Frame row numbers sampled for each field, progressive only uses field 0.
+	 * Fields are read in place from the interleaved frame, field 1 on even rows.
+	 */
+	int field_count;
+	int wss_rows[2][WSS_ROWS];
+
+    enum klsmpte2064_frame_rate_e frame_rate; /* FRAMERATE_UNDEFINED unless given at allocation */
+#define CONTAINER_TEMPLATE_SIZE 8
+    uint8_t container_template[CONTAINER_TEMPLATE_SIZE]; /* Table 5 header and ID sub container, see core-encapsulation.c */
+
+    /* Push based container emission, see klsmpte2064_encapsulation_set_emit() */
+    void (*emit)(void *opaque, void *hdl, const uint8_t *data, uint32_t len, uint64_t frame, uint32_t flags);
+    void *emit_opaque;
+
+    /* Cost governor, see core-governor.c */
+    int governor_enabled;
+    struct klsmpte2064_governor_params_s governor_params;
+    int governor_line_count; /* wss_line_count as configured, restored at GOVERNOR_LEVEL_FULL */
+
+	/* Video - owned by the video push thread */
+	uint8_t *y_csc CACHELINE_ALIGNED;
+	uint8_t *y; 
+
     uint8_t wss_f4[WSS_ROWS][WSS_SAMPLES_PER_ROW]; /* 5.2.3.1 - figure 5 - frame or field we compare against */
     uint8_t wss_f3[WSS_ROWS][WSS_SAMPLES_PER_ROW]; /* 5.2.3.1 - figure 5 - basic unusued */
     uint8_t wss_f2[WSS_ROWS][WSS_SAMPLES_PER_ROW]; /* 5.2.3.1 - figure 5 - always the current frame */
 
-    int per_pixel_motion_threshold;
     uint8_t video_fingerprint_data_f4; /* 5.2.3.2 */
     uint8_t video_fingerprint_data_f3; /* 5.2.3.2 */
     uint8_t video_fingerprint_data_f2; /* 5.2.3.2 */
     uint64_t fingerprints_calculated;
+    /* Discontinuities, see klsmpte2064_video_signal_discontinuity() */
+    int video_discontinuity; /* Set from any thread, taken by the next video push */
+    int video_resync_pending; /* Next frame is compared against a one frame old reference */
+    uint8_t video_flags; /* KLSMPTE2064_CONTAINER_* of the most recent frame */
     //
     double motion;
 
-	/* The window subsamples an image based on 16 lines.
-	 * Cache those line numebrs that are specific to resolution.
-	 */
-	int wss_lines[WSS_ROWS];
-	int wss_line_count;
+    /* Video analytics from the windowed samples, see core-analytics.c */
+    int analytics_enabled;
+    struct klsmpte2064_video_analytics_params_s analytics_params;
+    struct klsmpte2064_video_analytics_s analytics; /* Most recent frame */
+
+    /* Grid capture, see klsmpte2064_video_set_grid_capture() */
+    void (*grid_sink)(void *opaque, const uint8_t *data, uint32_t len);
+    void *grid_opaque;
+    uint8_t grid_record[KLSMPTE2064_GRID_RECORD_SIZE(2)];
+
+    /* Cost governor window, see core-governor.c */
+    int governor_level; /* enum klsmpte2064_governor_level_e, read by the other threads */
+    uint32_t governor_frames; /* Frames in the current window */
+    uint64_t governor_video_ns; /* Video push time in the current window */
+    uint32_t governor_average_us; /* Per frame cost of the last window */
+    uint32_t governor_hold; /* Windows to wait before the next restore */
+    uint32_t governor_backoff; /* Hold applied after the next shed, doubles when a restore fails */
+    uint32_t governor_since_restore; /* Windows since the level was last restored */
+
+	/* Audio - owned by the audio push thread */
+	const struct tbl3_s *t3 CACHELINE_ALIGNED;
 
-	/* Audio */
 	/* Max samples per frame = (1000 / 23.97) × 48 = 2002.5 */
-	/* We'll pre-allocate sample buffers of audioMaxSampleCount = 2200 */
+	/* We'll pre-allocate sample buffers of audioMaxSampleCount = 2200,
+	 * klsmpte2064_audio_set_samplerate() grows them for higher rates.
+	 * Once bound, this is the capacity of the (possibly shared) audio scratch.
+	 */
 	int audioMaxSampleCount;
+	uint32_t sample_rate; /* Input rate, AUDIO_SAMPLE_RATE unless configured */
+	uint32_t decimate; /* Fused pre-decimation factor, 1 when disabled. Analysis rate is sample_rate / decimate */
+	enum klsmpte2064_audio_pipeline_e audio_pipeline; /* Detector arithmetic, see core-audio.c */
+	float silence_level; /* Linear peak at or below which a frame is silent */
+	uint32_t audio_clips[AFP_SLOTS]; /* Full scale input samples downmixed since the slot last fingerprinted */
+	struct klsmpte2064_audio_levels_s levels[AFP_SLOTS];
+	struct audio_decimate_s decim[AFP_SLOTS];
+	uint64_t governor_audio_ns; /* Audio push time, taken by the video thread once per window */
 	float *bufA;
 	float *Es;
 	float *Ms;
 	uint8_t *comp_bit;
 	uint8_t *result;
 
-	struct klbs_context_s fp_bs[AUDIOTYPE_MAX]; /* One fingerprint per audio input type */
-	uint8_t fp_buffer[AUDIOTYPE_MAX][8];
+	struct klbs_context_s fp_bs[AFP_SLOTS]; /* One fingerprint per audio input type or program */
+	uint8_t fp_buffer[AFP_SLOTS][8];
+	uint8_t afp_mixtype[AFP_SLOTS];
 	/* Table 13 states that maximum number of fingerprint bytes for a framerate is 5.
 	 * The spec seems inconsistent because table 3 stats that for 60fps, the
 	 * decimation is 50 or 52 bits depending on framerate, resulting in 6.25 or 6.5 bytes.
@@ -105,12 +315,123 @@ struct ctx_s
 	uint32_t timebase_num;
 	uint32_t timebase_den;
 
-    /* Encapsulation */
-    struct klbs_context_s *bs;
-    uint8_t sequence_counter;
-};
+	/* Audio programs, each downmixed from a group of interleaved channels
+	 * in a single pass, see klsmpte2064_audio_programs_push().
+	 */
+	struct klsmpte2064_audio_program_s programs[KLSMPTE2064_AUDIO_PROGRAMS_MAX];
+	uint32_t programCount;
+	float *programBuf; /* programCount * audioMaxSampleCount, from the audio scratch */
+	struct downmix_plan_s downmix; /* Programs compiled for the input layout, see core-downmix.c */
+
+	/* Streaming audio, see klsmpte2064_audio_stream_push().
+	 * One preallocated accumulator per audio type, each holding a single
+	 * video frames worth of downmixed samples.
+	 */
+	float *stream_acc;
+	uint32_t stream_frame_max; /* Largest frame in samples across table 3 */
+	uint32_t stream_count[AUDIOTYPE_MAX]; /* Samples accumulated towards the current frame */
+	uint64_t stream_frames[AUDIOTYPE_MAX]; /* Frames completed, drives the 1601/1602 style cadence */
+
+	/* Published snapshots, one writer each, read by the pack step */
+	uint32_t video_pub_seq CACHELINE_ALIGNED;
+	struct fp_frame_s video_pub; /* Only the video fields are used */
+	uint32_t analytics_pub_seq; /* Written by the video push thread */
+	struct klsmpte2064_video_analytics_s analytics_pub;
+	uint32_t audio_pub_seq CACHELINE_ALIGNED;
+	struct fp_frame_s audio_pub; /* Only the audio fields are used */
+	struct klsmpte2064_audio_levels_s levels_pub[AFP_SLOTS];
+
+    /* Encapsulation - owned by the pack thread */
+    uint8_t sequence_counter CACHELINE_ALIGNED;
+
+	/* A/V alignment buffer, see core-align.c.
+	 * Frames are paired by PTS, the lock only protects the ring and the emission state.
+	 */
+#define ALIGN_MAX_FRAMES 8
+	pthread_mutex_t align_mutex CACHELINE_ALIGNED;
+	struct fp_frame_s align_frames[ALIGN_MAX_FRAMES]; /* Ordered by pts, oldest first */
+	int align_count;
+	uint32_t align_audio_mask; /* Audio types we expect per frame, learned from pushes */
+	int64_t align_last_video_pts;
+	int64_t align_frame_duration; /* 90KHz ticks */
+	int64_t align_audio_duration; /* 90KHz ticks, from the audio timebase until video has set the above */
+
+	/* Push based emission, also under align_mutex, see core-align.c */
+	uint32_t emit_seen; /* Audio slots expected in every container, learned from pushes */
+	uint32_t emit_fresh; /* Audio slots published since the last video container */
+	uint64_t emit_frame; /* Video containers emitted */
+#define EMIT_WINDOW 8
+	uint32_t emit_absent[EMIT_WINDOW]; /* Audio slots the most recent containers went without, by frame % EMIT_WINDOW */
+	uint32_t emit_expired[AFP_SLOTS]; /* Late fingerprints owed to containers that left the window */
+} CACHELINE_ALIGNED;
+
+/* Each owner's region must start a line of its own */
+_Static_assert(offsetof(struct ctx_s, y_csc) % CACHELINE_SIZE == 0, "video region not cache line aligned");
+_Static_assert(offsetof(struct ctx_s, t3) % CACHELINE_SIZE == 0, "audio region not cache line aligned");
+_Static_assert(offsetof(struct ctx_s, video_pub_seq) % CACHELINE_SIZE == 0, "published video not cache line aligned");
+_Static_assert(offsetof(struct ctx_s, audio_pub_seq) % CACHELINE_SIZE == 0, "published audio not cache line aligned");
+_Static_assert(offsetof(struct ctx_s, sequence_counter) % CACHELINE_SIZE == 0, "encapsulation region not cache line aligned");
+_Static_assert(offsetof(struct ctx_s, align_mutex) % CACHELINE_SIZE == 0, "align region not cache line aligned");
+
+/* Cost governor, see core-governor.c. Pushes are timed only while it's enabled. */
+uint64_t klsmpte2064_governor_clock(void);
+void klsmpte2064_governor_video(struct ctx_s *ctx, uint64_t start);
+
+static inline uint64_t klsmpte2064_governor_start(const struct ctx_s *ctx)
+{
+	return ctx && ctx->governor_enabled ? klsmpte2064_governor_clock() : 0;
+}
+
+static inline void klsmpte2064_governor_audio(struct ctx_s *ctx, uint64_t start)
+{
+	if (start) {
+		__atomic_fetch_add(&ctx->governor_audio_ns, klsmpte2064_governor_clock() - start, __ATOMIC_RELAXED);
+	}
+}
+
+/* Console debug level, suspended while the governor sheds optional work */
+static inline int klsmpte2064_verbose(const struct ctx_s *ctx)
+{
+	if (__atomic_load_n(&ctx->governor_level, __ATOMIC_RELAXED) >= GOVERNOR_LEVEL_ESSENTIAL) {
+		return 0;
+	}
+	return ctx->verbose;
+}
+
+void klsmpte2064_video_select_kernels(struct ctx_s *ctx);
+void klsmpte2064_video_analytics_frame(struct ctx_s *ctx);
+
+void klsmpte2064_frame_capture_video(struct ctx_s *ctx, struct fp_frame_s *f);
+void klsmpte2064_frame_capture_audio(struct ctx_s *ctx, int slot, struct fp_frame_s *f);
+void klsmpte2064_publish_video(struct ctx_s *ctx);
+void klsmpte2064_publish_audio(struct ctx_s *ctx, uint32_t slotMask);
+void klsmpte2064_encapsulation_init(struct ctx_s *ctx);
+int klsmpte2064_encapsulation_pack_frame(struct ctx_s *ctx, const struct fp_frame_s *f, uint8_t *data, uint32_t len, uint32_t *usedLength);
+
+void klsmpte2064_align_init(struct ctx_s *ctx);
+void klsmpte2064_align_free(struct ctx_s *ctx);
+void klsmpte2064_emit_video(struct ctx_s *ctx);
+void klsmpte2064_emit_audio(struct ctx_s *ctx, uint32_t slotMask);
+void klsmpte2064_emit_retire(struct ctx_s *ctx, uint32_t slotMask);
+
+const struct klsmpte2064_allocator_s *klsmpte2064_mem_allocator(const struct klsmpte2064_allocator_s *allocator);
+void *klsmpte2064_mem_alloc(const struct klsmpte2064_allocator_s *allocator, size_t size);
+void klsmpte2064_mem_free(const struct klsmpte2064_allocator_s *allocator, void *ptr);
+void *klsmpte2064_mem_alloc_aligned(const struct klsmpte2064_allocator_s *allocator, size_t size);
+void klsmpte2064_mem_free_aligned(const struct klsmpte2064_allocator_s *allocator, void *ptr);
+int klsmpte2064_scratch_reserve_video(struct scratch_s *s, size_t lumaSize, size_t lumaCscSize);
+int klsmpte2064_scratch_reserve_audio(struct scratch_s *s, uint32_t samples, uint32_t programs);
+int klsmpte2064_scratch_reserve_batch(struct scratch_s *s, uint32_t samples);
+int klsmpte2064_context_mem_alloc(struct ctx_s **ctx, const struct klsmpte2064_context_params_s *params);
+void klsmpte2064_context_mem_free(struct ctx_s *ctx);
+
+int klsmpte2064_video_bind(struct ctx_s *ctx);
+int klsmpte2064_audio_bind(struct ctx_s *ctx, uint32_t sampleCount);
+int klsmpte2064_audio_stream_alloc(struct ctx_s *ctx);
+void klsmpte2064_audio_stream_free(struct ctx_s *ctx);
 
-int klsmpte2064_audio_alloc(struct ctx_s *ctx);
-void klsmpte2064_audio_free(struct ctx_s *ctx);
+int klsmpte2064_downmix_build(struct ctx_s *ctx, enum klsmpte2064_sample_format_e format, int planar, uint32_t channelCount);
+uint32_t klsmpte2064_downmix_run(struct ctx_s *ctx, const void *planes[], uint32_t sampleCount);
+uint32_t klsmpte2064_audio_decimate(struct audio_decimate_s *d, uint32_t factor, const float *in, uint32_t count, float *out);
 
 #endif /* _LIBKLSMPTE2064_PRIVATE_H */
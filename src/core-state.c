@@ -0,0 +1,403 @@
+#include <libklsmpte2064/klsmpte2064.h>
+
+#include "core-private.h"
+
+#include <string.h>
+
+/* Context state snapshot, for hot failover and fast restarts.
+ *
+ * Only state that survives from one push to the next is serialised. The audio
+ * envelope and mean filters (5.3.3, 5.3.4) restart every frame, they have no
+ * history to carry, but the decimators and any partially streamed frame do.
+ * The last published audio fingerprints are carried too, containers repeat them
+ * until the next audio frame completes, as are the freeze/black and silence runs.
+ * Every field is written little endian at a fixed width, independent of the
+ * host and of struct ctx_s layout:
+ *
+ *  'KLST' | version | total length | configuration | video | analytics | container | alignment | audio
+ *
+ * The configuration section is compared, not restored, it catches states
+ * from a context set up differently.
+ */
+
+#define STATE_MAGIC   0x4b4c5354 /* 'KLST' */
+#define STATE_VERSION 3
+
+struct state_cursor_s
+{
+	uint8_t *buf;       /* NULL when only measuring */
+	const uint8_t *src; /* Restore */
+	uint32_t len;
+	uint32_t pos;
+	int overrun;
+};
+
+static void _state_put(struct state_cursor_s *c, uint64_t v, uint32_t bytes)
+{
+	if (c->buf && c->pos + bytes <= c->len) {
+		for (uint32_t i = 0; i < bytes; i++) {
+			c->buf[c->pos + i] = v >> (i * 8);
+		}
+	}
+	c->pos += bytes;
+}
+
+static uint64_t _state_get(struct state_cursor_s *c, uint32_t bytes)
+{
+	uint64_t v = 0;
+
+	if (c->overrun || c->pos + bytes > c->len) {
+		c->overrun = 1;
+		return 0;
+	}
+	for (uint32_t i = 0; i < bytes; i++) {
+		v |= (uint64_t)c->src[c->pos + i] << (i * 8);
+	}
+	c->pos += bytes;
+
+	return v;
+}
+
+static void _state_put_bytes(struct state_cursor_s *c, const uint8_t *p, uint32_t bytes)
+{
+	if (c->buf && c->pos + bytes <= c->len) {
+		memcpy(c->buf + c->pos, p, bytes);
+	}
+	c->pos += bytes;
+}
+
+/* Copy out bytes, or just skip over them when p is NULL */
+static void _state_get_bytes(struct state_cursor_s *c, uint8_t *p, uint32_t bytes)
+{
+	if (c->overrun || c->pos + bytes > c->len) {
+		c->overrun = 1;
+		return;
+	}
+	if (p) {
+		memcpy(p, c->src + c->pos, bytes);
+	}
+	c->pos += bytes;
+}
+
+static void _state_put_float(struct state_cursor_s *c, float f)
+{
+	uint32_t v;
+	memcpy(&v, &f, sizeof(v));
+	_state_put(c, v, 4);
+}
+
+static float _state_get_float(struct state_cursor_s *c)
+{
+	uint32_t v = _state_get(c, 4);
+	float f;
+	memcpy(&f, &v, sizeof(f));
+	return f;
+}
+
+static void _state_put_double(struct state_cursor_s *c, double d)
+{
+	uint64_t v;
+	memcpy(&v, &d, sizeof(v));
+	_state_put(c, v, 8);
+}
+
+static double _state_get_double(struct state_cursor_s *c)
+{
+	uint64_t v = _state_get(c, 8);
+	double d;
+	memcpy(&d, &v, sizeof(d));
+	return d;
+}
+
+static void _state_write(struct ctx_s *ctx, struct state_cursor_s *c)
+{
+	_state_put(c, STATE_MAGIC, 4);
+	_state_put(c, STATE_VERSION, 4);
+	_state_put(c, 0, 4); /* Total length, patched by the caller */
+
+	/* Configuration */
+	_state_put(c, ctx->colorspace, 4);
+	_state_put(c, ctx->width, 4);
+	_state_put(c, ctx->height, 4);
+	_state_put(c, ctx->progressive, 4);
+	_state_put(c, ctx->sample_rate, 4);
+	_state_put(c, ctx->decimate, 4);
+	_state_put(c, ctx->programCount, 4);
+	_state_put(c, ctx->frame_rate, 4);
+	_state_put(c, AFP_SLOTS, 4);
+	_state_put(c, AUDIOTYPE_MAX, 4);
+
+	/* Video, 5.2.3.1 motion history */
+	_state_put(c, ctx->fingerprints_calculated, 8);
+	_state_put(c, ctx->video_fingerprint_data_f4, 1);
+	_state_put(c, ctx->video_fingerprint_data_f3, 1);
+	_state_put(c, ctx->video_fingerprint_data_f2, 1);
+	_state_put(c, ctx->video_flags, 1);
+	_state_put(c, ctx->video_resync_pending, 1);
+	_state_put(c, __atomic_load_n(&ctx->video_discontinuity, __ATOMIC_ACQUIRE), 1);
+	_state_put_bytes(c, &ctx->wss_f4[0][0], sizeof(ctx->wss_f4));
+	_state_put_bytes(c, &ctx->wss_f3[0][0], sizeof(ctx->wss_f3));
+	_state_put_bytes(c, &ctx->wss_f2[0][0], sizeof(ctx->wss_f2));
+
+	/* Analytics, the runs and the previous frame the next edges are found against */
+	_state_put(c, ctx->analytics.frame, 8);
+	_state_put_double(c, ctx->analytics.meanLuma);
+	_state_put_double(c, ctx->analytics.variance);
+	_state_put_double(c, ctx->analytics.motion);
+	_state_put_double(c, ctx->analytics.difference);
+	_state_put(c, ctx->analytics.freezeFrames, 4);
+	_state_put(c, ctx->analytics.blackFrames, 4);
+	_state_put(c, ctx->analytics.flags, 4);
+
+	/* Container */
+	_state_put(c, ctx->sequence_counter, 1);
+
+	/* Alignment, frames waiting in the ring aren't carried */
+	pthread_mutex_lock(&ctx->align_mutex);
+	_state_put(c, (uint64_t)ctx->align_last_video_pts, 8);
+	_state_put(c, (uint64_t)ctx->align_frame_duration, 8);
+	_state_put(c, ctx->align_audio_mask, 4);
+	pthread_mutex_unlock(&ctx->align_mutex);
+
+	/* Audio */
+	for (int i = 0; i < AFP_SLOTS; i++) {
+		_state_put(c, ctx->decim[i].phase, 4);
+		_state_put_float(c, ctx->decim[i].cur);
+		_state_put_float(c, ctx->decim[i].next);
+	}
+	for (int i = 0; i < AFP_SLOTS; i++) {
+		/* Levels, the silence run continues across the restore */
+		_state_put(c, ctx->levels[i].frames, 8);
+		_state_put_float(c, ctx->levels[i].peak);
+		_state_put_float(c, ctx->levels[i].mean);
+		_state_put(c, ctx->levels[i].silenceFrames, 4);
+		_state_put(c, ctx->levels[i].clippedSamples, 4);
+	}
+	for (int i = 0; i < AFP_SLOTS; i++) {
+		/* Most recently published, repeated into containers until the next fingerprint completes */
+		_state_put(c, ctx->audio_pub.afp_len[i], 1);
+		_state_put(c, ctx->audio_pub.afp_mixtype[i], 1);
+		_state_put_bytes(c, &ctx->audio_pub.afp[i][0], sizeof(ctx->audio_pub.afp[i]));
+	}
+	for (int t = 0; t < AUDIOTYPE_MAX; t++) {
+		const float *acc = ctx->stream_acc + (t * ctx->stream_frame_max);
+		_state_put(c, ctx->stream_frames[t], 8);
+		_state_put(c, ctx->stream_count[t], 4);
+		for (uint32_t i = 0; i < ctx->stream_count[t]; i++) {
+			_state_put_float(c, acc[i]);
+		}
+	}
+}
+
+/* Parse a saved state. With apply == 0 the state is only validated,
+ * so the context is never left half restored.
+ */
+static int _state_read(struct ctx_s *ctx, struct state_cursor_s *c, int apply)
+{
+	if (_state_get(c, 4) != STATE_MAGIC || _state_get(c, 4) != STATE_VERSION) {
+		return -EBADMSG;
+	}
+	if (_state_get(c, 4) != c->len) {
+		return -EBADMSG;
+	}
+
+	/* Configuration must match */
+	int mismatch = 0;
+	mismatch |= _state_get(c, 4) != ctx->colorspace;
+	mismatch |= _state_get(c, 4) != ctx->width;
+	mismatch |= _state_get(c, 4) != ctx->height;
+	mismatch |= _state_get(c, 4) != ctx->progressive;
+	mismatch |= _state_get(c, 4) != ctx->sample_rate;
+	mismatch |= _state_get(c, 4) != ctx->decimate;
+	mismatch |= _state_get(c, 4) != ctx->programCount;
+	mismatch |= _state_get(c, 4) != ctx->frame_rate;
+	mismatch |= _state_get(c, 4) != AFP_SLOTS;
+	mismatch |= _state_get(c, 4) != AUDIOTYPE_MAX;
+	if (c->overrun) {
+		return -EBADMSG;
+	}
+	if (mismatch) {
+		return -EINVAL;
+	}
+
+	/* Video */
+	uint64_t fingerprints_calculated = _state_get(c, 8);
+	uint8_t f4 = _state_get(c, 1);
+	uint8_t f3 = _state_get(c, 1);
+	uint8_t f2 = _state_get(c, 1);
+	uint8_t flags = _state_get(c, 1);
+	uint8_t resync_pending = _state_get(c, 1);
+	uint8_t discontinuity = _state_get(c, 1);
+	if (apply) {
+		ctx->fingerprints_calculated = fingerprints_calculated;
+		ctx->video_fingerprint_data_f4 = f4;
+		ctx->video_fingerprint_data_f3 = f3;
+		ctx->video_fingerprint_data_f2 = f2;
+		ctx->video_flags = flags;
+		ctx->video_resync_pending = resync_pending;
+		__atomic_store_n(&ctx->video_discontinuity, discontinuity, __ATOMIC_RELEASE);
+	}
+	_state_get_bytes(c, apply ? &ctx->wss_f4[0][0] : NULL, sizeof(ctx->wss_f4));
+	_state_get_bytes(c, apply ? &ctx->wss_f3[0][0] : NULL, sizeof(ctx->wss_f3));
+	_state_get_bytes(c, apply ? &ctx->wss_f2[0][0] : NULL, sizeof(ctx->wss_f2));
+
+	/* Analytics */
+	struct klsmpte2064_video_analytics_s analytics;
+	analytics.frame = _state_get(c, 8);
+	analytics.meanLuma = _state_get_double(c);
+	analytics.variance = _state_get_double(c);
+	analytics.motion = _state_get_double(c);
+	analytics.difference = _state_get_double(c);
+	analytics.freezeFrames = _state_get(c, 4);
+	analytics.blackFrames = _state_get(c, 4);
+	analytics.flags = _state_get(c, 4);
+	if (apply) {
+		ctx->analytics = analytics;
+		seqlock_write_begin(&ctx->analytics_pub_seq);
+		ctx->analytics_pub = analytics;
+		seqlock_write_end(&ctx->analytics_pub_seq);
+	}
+
+	/* Container */
+	uint8_t sequence_counter = _state_get(c, 1);
+	if (apply) {
+		ctx->sequence_counter = sequence_counter;
+	}
+
+	/* Alignment */
+	int64_t last_pts = (int64_t)_state_get(c, 8);
+	int64_t duration = (int64_t)_state_get(c, 8);
+	uint32_t audio_mask = _state_get(c, 4);
+	if (apply) {
+		pthread_mutex_lock(&ctx->align_mutex);
+		ctx->align_count = 0;
+		ctx->align_last_video_pts = last_pts;
+		ctx->align_frame_duration = duration;
+		ctx->align_audio_mask = audio_mask;
+		pthread_mutex_unlock(&ctx->align_mutex);
+	}
+
+	/* Audio */
+	for (int i = 0; i < AFP_SLOTS; i++) {
+		uint32_t phase = _state_get(c, 4);
+		float cur = _state_get_float(c);
+		float next = _state_get_float(c);
+		if (phase >= ctx->decimate && ctx->decimate > 1) {
+			return -EBADMSG;
+		}
+		if (apply) {
+			ctx->decim[i].phase = phase;
+			ctx->decim[i].cur = cur;
+			ctx->decim[i].next = next;
+		}
+	}
+	if (apply) {
+		seqlock_write_begin(&ctx->audio_pub_seq);
+		ctx->audio_pub.audio_mask = 0;
+	}
+	for (int i = 0; i < AFP_SLOTS; i++) {
+		struct klsmpte2064_audio_levels_s levels;
+		levels.frames = _state_get(c, 8);
+		levels.peak = _state_get_float(c);
+		levels.mean = _state_get_float(c);
+		levels.silenceFrames = _state_get(c, 4);
+		levels.clippedSamples = _state_get(c, 4);
+		if (apply) {
+			ctx->levels[i] = levels;
+			ctx->levels_pub[i] = levels;
+		}
+	}
+	for (int i = 0; i < AFP_SLOTS; i++) {
+		uint8_t afp_len = _state_get(c, 1);
+		uint8_t mixtype = _state_get(c, 1);
+		if (afp_len > sizeof(ctx->audio_pub.afp[i])) {
+			afp_len = 0; /* Validated below, once the lock is dropped */
+			c->overrun = 1;
+		}
+		_state_get_bytes(c, apply ? &ctx->audio_pub.afp[i][0] : NULL, sizeof(ctx->audio_pub.afp[i]));
+		if (apply) {
+			ctx->audio_pub.afp_len[i] = afp_len;
+			ctx->audio_pub.afp_mixtype[i] = mixtype;
+			if (afp_len) {
+				ctx->audio_pub.audio_mask |= (1 << i);
+			}
+		}
+	}
+	if (apply) {
+		seqlock_write_end(&ctx->audio_pub_seq);
+	}
+	if (c->overrun) {
+		return -EBADMSG;
+	}
+	for (int t = 0; t < AUDIOTYPE_MAX; t++) {
+		float *acc = ctx->stream_acc + (t * ctx->stream_frame_max);
+		uint64_t frames = _state_get(c, 8);
+		uint32_t count = _state_get(c, 4);
+		if (count >= ctx->stream_frame_max) {
+			return -EBADMSG;
+		}
+		for (uint32_t i = 0; i < count; i++) {
+			float v = _state_get_float(c);
+			if (apply) {
+				acc[i] = v;
+			}
+		}
+		if (apply) {
+			ctx->stream_frames[t] = frames;
+			ctx->stream_count[t] = count;
+		}
+	}
+
+	if (c->overrun || c->pos != c->len) {
+		return -EBADMSG;
+	}
+
+	return 0;
+}
+
+int klsmpte2064_context_state_save(void *hdl, uint8_t *data, uint32_t len, uint32_t *usedLength)
+{
+	struct ctx_s *ctx = (struct ctx_s *)hdl;
+	if (!ctx || !usedLength || !ctx->stream_acc) {
+		return -EINVAL;
+	}
+
+	struct state_cursor_s c = { .buf = data, .len = data ? len : 0 };
+	_state_write(ctx, &c);
+
+	*usedLength = c.pos;
+	if (!data || c.pos > len) {
+		return -ENOSPC;
+	}
+
+	/* Patch the total length */
+	c.pos = 8;
+	_state_put(&c, *usedLength, 4);
+
+	return 0;
+}
+
+int klsmpte2064_context_state_restore(void *hdl, const uint8_t *data, uint32_t len)
+{
+	struct ctx_s *ctx = (struct ctx_s *)hdl;
+	if (!ctx || !data || !ctx->stream_acc) {
+		return -EINVAL;
+	}
+
+	struct state_cursor_s c = { .src = data, .len = len };
+	int r = _state_read(ctx, &c, 0);
+	if (r < 0) {
+		return r;
+	}
+
+	c.pos = 0;
+	r = _state_read(ctx, &c, 1);
+	if (r < 0) {
+		return r;
+	}
+
+	/* Containers carry the restored fingerprints straight away, not from the next push */
+	klsmpte2064_publish_video(ctx);
+
+	return 0;
+}
@@ -0,0 +1,216 @@
+#include <libklsmpte2064/klsmpte2064.h>
+
+#include "core-private.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* ISO13818-1 packetisation of containers, see klsmpte2064_ts_packetise().
+ *
+ * 2.4.3.6 PES header, PTS only:
+ *  00 00 01 | stream_id | PES_packet_length | 0x84 data_alignment | 0x80 PTS | 5 | PTS
+ *
+ * 2.4.3.2 transport packets, the PES is written straight into the callers
+ * packets, the last one padded with adaptation field stuffing (2.4.3.5) so
+ * the next PES starts a packet of its own.
+ */
+
+#define TS_SYNC_BYTE      0x47
+#define TS_PAYLOAD_SIZE   (KLSMPTE2064_TS_PACKET_SIZE - 4)
+#define TS_PCR_AF_SIZE    8 /* adaptation_field_length, flags, 6 byte PCR */
+#define PES_HEADER_SIZE   14
+#define PES_PRIVATE_STREAM_1 0xbd
+
+/* 2.4.3.7 - These stream_ids carry no optional PES header, so no PTS */
+static int _ts_stream_id_valid(uint8_t id)
+{
+	switch (id) {
+	case 0xbc: /* program_stream_map */
+	case 0xbe: /* padding_stream */
+	case 0xbf: /* private_stream_2 */
+	case 0xf0: /* ECM */
+	case 0xf1: /* EMM */
+	case 0xf2: /* DSMCC */
+	case 0xf8: /* ITU-T H.222.1 type E */
+	case 0xff: /* program_stream_directory */
+		return 0;
+	default:
+		return id >= 0xbc;
+	}
+}
+
+struct ts_s
+{
+	struct klsmpte2064_allocator_s allocator;
+	uint16_t pid;
+	uint8_t stream_id;
+	uint8_t cc; /* continuity_counter of the next packet */
+};
+
+int klsmpte2064_ts_alloc(void **hdl, const struct klsmpte2064_ts_params_s *params)
+{
+	if (!hdl || !params || params->pid < 0x20 || params->pid > 0x1ffe) {
+		return -EINVAL;
+	}
+	if (params->streamId && !_ts_stream_id_valid(params->streamId)) {
+		return -EINVAL;
+	}
+
+	const struct klsmpte2064_allocator_s *allocator = klsmpte2064_mem_allocator(params->allocator);
+	if (!allocator->alloc || !allocator->free) {
+		return -EINVAL;
+	}
+
+	struct ts_s *ts = klsmpte2064_mem_alloc(allocator, sizeof(*ts));
+	if (!ts) {
+		return -ENOMEM;
+	}
+	memset(ts, 0, sizeof(*ts));
+	ts->allocator = *allocator;
+	ts->pid = params->pid;
+	ts->stream_id = params->streamId ? params->streamId : PES_PRIVATE_STREAM_1;
+
+	*hdl = ts;
+	return 0;
+}
+
+void klsmpte2064_ts_free(void *hdl)
+{
+	struct ts_s *ts = (struct ts_s *)hdl;
+	if (!ts) {
+		return;
+	}
+
+	struct klsmpte2064_allocator_s allocator = ts->allocator;
+	klsmpte2064_mem_free(&allocator, ts);
+}
+
+/* Transport packets needed for a PES of 'size' bytes */
+static uint32_t _ts_packet_count(uint32_t size, int pcr)
+{
+	uint32_t first = TS_PAYLOAD_SIZE - (pcr ? TS_PCR_AF_SIZE : 0);
+	if (size <= first) {
+		return 1;
+	}
+
+	return 1 + ((size - first) + TS_PAYLOAD_SIZE - 1) / TS_PAYLOAD_SIZE;
+}
+
+static void _ts_pes_header(const struct ts_s *ts, const struct klsmpte2064_ts_frame_s *f, uint8_t *h)
+{
+	uint64_t pts = (uint64_t)f->pts & 0x1ffffffffULL;
+	uint32_t length = (PES_HEADER_SIZE - 6) + f->len;
+
+	h[0] = 0x00;
+	h[1] = 0x00;
+	h[2] = 0x01;
+	h[3] = ts->stream_id;
+	h[4] = length >> 8; /* PES_packet_length */
+	h[5] = length;
+	h[6] = 0x84; /* '10', data_alignment_indicator */
+	h[7] = 0x80; /* PTS_DTS_flags '10' */
+	h[8] = 5; /* PES_header_data_length */
+	h[9] = 0x21 | ((pts >> 29) & 0x0e); /* '0010', PTS[32..30], marker */
+	h[10] = pts >> 22;
+	h[11] = 0x01 | ((pts >> 14) & 0xfe);
+	h[12] = pts >> 7;
+	h[13] = 0x01 | ((pts << 1) & 0xfe);
+}
+
+/* 2.4.3.5 - Adaptation field, 'size' bytes including adaptation_field_length */
+static void _ts_adaptation_field(uint8_t *af, uint32_t size, int64_t pcr)
+{
+	af[0] = size - 1; /* adaptation_field_length */
+	if (size == 1) {
+		return;
+	}
+
+	uint32_t n = 2;
+	af[1] = 0x00;
+	if (pcr >= 0) {
+		uint64_t base = ((uint64_t)pcr / 300) & 0x1ffffffffULL;
+		uint32_t ext = (uint64_t)pcr % 300;
+
+		af[1] |= 0x10; /* PCR_flag */
+		af[2] = base >> 25;
+		af[3] = base >> 17;
+		af[4] = base >> 9;
+		af[5] = base >> 1;
+		af[6] = ((base & 1) << 7) | 0x7e | (ext >> 8); /* reserved */
+		af[7] = ext;
+		n = TS_PCR_AF_SIZE;
+	}
+	memset(af + n, 0xff, size - n); /* stuffing_byte */
+}
+
+int klsmpte2064_ts_packetise(void *hdl, const struct klsmpte2064_ts_frame_s *frames, uint32_t frameCount,
+	uint8_t *packets, uint32_t packetCount, uint32_t *framesUsed)
+{
+	struct ts_s *ts = (struct ts_s *)hdl;
+	if (!ts || (frameCount && (!frames || !packets))) {
+		return -EINVAL;
+	}
+
+	/* Reject a bad batch before any packet is written or the continuity counter moves */
+	for (uint32_t i = 0; i < frameCount; i++) {
+		const struct klsmpte2064_ts_frame_s *f = &frames[i];
+		if (!f->data || f->len == 0 || f->len > 0xffff - (PES_HEADER_SIZE - 6) || f->pts < 0) {
+			return -EINVAL;
+		}
+	}
+
+	uint32_t written = 0;
+	uint32_t i;
+
+	for (i = 0; i < frameCount; i++) {
+		const struct klsmpte2064_ts_frame_s *f = &frames[i];
+		int pcr = f->pcr >= 0;
+		uint32_t size = PES_HEADER_SIZE + f->len;
+		if (_ts_packet_count(size, pcr) > packetCount - written) {
+			break;
+		}
+
+		uint8_t header[PES_HEADER_SIZE];
+		_ts_pes_header(ts, f, header);
+
+		/* The PES is read from the header, then the container, no staging copy */
+		uint32_t offset = 0;
+		while (offset < size) {
+			uint8_t *pkt = packets + (written++ * KLSMPTE2064_TS_PACKET_SIZE);
+			uint32_t capacity = TS_PAYLOAD_SIZE - ((pcr && offset == 0) ? TS_PCR_AF_SIZE : 0);
+			uint32_t payload = size - offset < capacity ? size - offset : capacity;
+			uint32_t af = TS_PAYLOAD_SIZE - payload;
+
+			pkt[0] = TS_SYNC_BYTE;
+			pkt[1] = (offset == 0 ? 0x40 : 0x00) | (ts->pid >> 8); /* payload_unit_start_indicator */
+			pkt[2] = ts->pid;
+			pkt[3] = (af ? 0x30 : 0x10) | ts->cc; /* adaptation_field_control */
+			ts->cc = (ts->cc + 1) & 0x0f;
+
+			if (af) {
+				_ts_adaptation_field(pkt + 4, af, offset == 0 ? f->pcr : -1);
+			}
+
+			uint8_t *dst = pkt + 4 + af;
+			uint32_t end = offset + payload;
+			if (offset < PES_HEADER_SIZE) {
+				uint32_t n = (end < PES_HEADER_SIZE ? end : PES_HEADER_SIZE) - offset;
+				memcpy(dst, header + offset, n);
+				dst += n;
+				offset += n;
+			}
+			memcpy(dst, f->data + (offset - PES_HEADER_SIZE), end - offset);
+			offset = end;
+		}
+	}
+
+	if (i == 0 && frameCount) {
+		return -ENOSPC;
+	}
+	if (framesUsed) {
+		*framesUsed = i;
+	}
+
+	return written;
+}
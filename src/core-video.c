@@ -7,9 +7,17 @@
 #include <string.h>
 #include <inttypes.h>
 
-static int _video_prefilter(struct ctx_s *ctx, const uint8_t *luma, int src_stride);
-static int _video_window_subsampling_progressive(struct ctx_s *ctx, int src_stride);
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#else
+#define HAVE_X86_SIMD 0
+#endif
+
+static void _video_window_rotate(struct ctx_s *ctx);
+static int _video_window_subsampling(struct ctx_s *ctx, int src_stride, int field);
 static int _video_window_compute_motion(struct ctx_s *ctx);
+static void _video_grid_capture(struct ctx_s *ctx, int reseed);
 
 /* Table 1 - Video Format Prefilter */
 struct tbl1_s tbl1[] = {
@@ -20,7 +28,7 @@ struct tbl1_s tbl1[] = {
 	{ 1, 1920, 1080, 3, { -1,  0,  1,  0,  0,  0 } },
 	{ 1, 1280,  720, 2, { -1,  0,  0,  0,  0,  0 } },
 	{ 0,  720,  485, 0, {  0,  0,  0,  0,  0,  0 } },
-	{ 1,  720,  576, 0, {  0,  0,  0,  0,  0,  0 } },
+	{ 0,  720,  576, 0, {  0,  0,  0,  0,  0,  0 } },
 };
 
 /* Table 2 - Windowing Coordinates per video format.
@@ -96,40 +104,144 @@ const struct tbl2_s *lookupTable2(int progressive, int width, int height)
 	return NULL; /* Failed */
 }
 
-int _video_push_yuv420p(struct ctx_s *ctx, const uint8_t *lumaplane, int src_stride)
+/* Window and motion detect the fields of a frame, then publish it. The grids
+ * are subsampled from the prefiltered luma in y, or for a replay taken from a
+ * captured record, one WSS_SAMPLES_PER_FRAME grid per field.
+ */
+static int _video_process_fields(struct ctx_s *ctx, int src_stride, const uint8_t *grids, int reseed)
 {
-	/* Step 1: pre-filter */
-	/* "The current field/frame shall be compared with the second preceding
-	 * field/frame to calculate a difference used for further processing."
+	int r;
+
+	/* Fields are processed sequentially, field 1 then field 2,
+	 * both taken directly from the prefiltered interleaved frame.
 	 */
-	int r = _video_prefilter(ctx, lumaplane, src_stride);
-	if (r < 0) {
-		return -1;
+	for (int field = 0; field < ctx->field_count; field++) {
+
+		/* Step 2: windowing */
+		if (grids) {
+			_video_window_rotate(ctx);
+			memcpy(&ctx->wss_f4[0][0], grids + (field * WSS_SAMPLES_PER_FRAME), sizeof(ctx->wss_f4));
+		} else {
+			r = _video_window_subsampling(ctx, src_stride, field);
+			if (r < 0) {
+				return -1;
+			}
+		}
+
+		/* After a discontinuity the history holds content from before the gap.
+		 * Reseed it with the first field after the gap so the next comparisons
+		 * are against real post gap content, not stale frames.
+		 */
+		if (reseed && field == 0) {
+			memcpy(&ctx->wss_f3[0][0], &ctx->wss_f4[0][0], sizeof(ctx->wss_f4));
+			memcpy(&ctx->wss_f2[0][0], &ctx->wss_f4[0][0], sizeof(ctx->wss_f4));
+		}
+
+		/* Step 3: motion detect */
+		r = _video_window_compute_motion(ctx);
+		if (r < 0) {
+			return -1;
+		}
 	}
 
-	/* Step 2: windowing */
-	r = _video_window_subsampling_progressive(ctx, src_stride);
-	if (r < 0) {
-		return -1;
+	/* The reseeded frame compared against itself. Interlaced is whole again on the
+	 * next frame, progressive compares with the second preceding frame so the next
+	 * frame can only reach back one.
+	 */
+	if (reseed) {
+		ctx->video_flags = KLSMPTE2064_CONTAINER_DISCONTINUITY;
+		ctx->video_resync_pending = ctx->progressive;
+	} else if (ctx->video_resync_pending) {
+		ctx->video_flags = KLSMPTE2064_CONTAINER_RESYNC;
+		ctx->video_resync_pending = 0;
+	} else {
+		ctx->video_flags = 0;
+	}
+
+	/* Make the fingerprints visible to the pack step */
+	klsmpte2064_publish_video(ctx);
+
+	if (ctx->grid_sink) {
+		_video_grid_capture(ctx, reseed);
+	}
+	/* Optional, shed first by the cost governor */
+	if (ctx->analytics_enabled && ctx->governor_level < GOVERNOR_LEVEL_ESSENTIAL) {
+		klsmpte2064_video_analytics_frame(ctx);
 	}
 
-	/* Step 3: motion detect */
-	r = _video_window_compute_motion(ctx);
+	return 0;
+}
+
+/* Prefilter, window, then motion detect a frame. The luma is read by the
+ * colorspace specific prefilter selected at context allocation.
+ */
+static int _video_push_luma(struct ctx_s *ctx, const uint8_t *lumaplane, int src_stride)
+{
+	/* Step 1: pre-filter */
+	/* "The current field/frame shall be compared with the second preceding
+	 * field/frame to calculate a difference used for further processing."
+	 */
+	int r = ctx->prefilter(ctx, lumaplane, src_stride);
 	if (r < 0) {
 		return -1;
 	}
 
-	return 0;
+	int reseed = __atomic_exchange_n(&ctx->video_discontinuity, 0, __ATOMIC_ACQUIRE);
+
+	return _video_process_fields(ctx, ctx->ystride, NULL, reseed);
 }
 
-int _video_push_v210(struct ctx_s *ctx, const uint8_t *lumaplane)
+static int _video_push_v210(struct ctx_s *ctx, const uint8_t *lumaplane)
 {
 	/* Convert from V210 to 8 bit then push a regular 8 bit frame */
 
 	v210_planar_unpack_c_to_8b((const uint32_t *)lumaplane, ctx->inputstride, ctx->y_csc, ctx->ystride, ctx->width, ctx->height,
 		&ctx->wss_lines[0], ctx->wss_line_count);
 
-	return _video_push_yuv420p(ctx, ctx->y_csc, ctx->ystride);
+	return _video_push_luma(ctx, ctx->y_csc, ctx->ystride);
+}
+
+/* Point y (and y_csc for V210) at the video scratch, growing it if needed.
+ * Called at the start of each push, the scratch may be shared and have been
+ * grown by another context. Only V210 needs a colorspace converted frame.
+ */
+int klsmpte2064_video_bind(struct ctx_s *ctx)
+{
+	struct scratch_s *s = ctx->video_scratch;
+	size_t size = ctx->ystride * ctx->height;
+
+	if (klsmpte2064_scratch_reserve_video(s, size, ctx->colorspace == COLORSPACE_V210 ? size : 0) < 0) {
+		return -ENOMEM;
+	}
+
+	ctx->y = s->y;
+	ctx->y_csc = s->y_csc;
+
+	return 0;
+}
+
+static int _video_push(struct ctx_s *ctx, const uint8_t *lumaplane)
+{
+	if (klsmpte2064_video_bind(ctx) < 0) {
+		return -ENOMEM;
+	}
+
+	switch (ctx->colorspace) {
+	case COLORSPACE_YUV420P:
+	case COLORSPACE_NV12:
+	case COLORSPACE_UYVY:
+	case COLORSPACE_P010:
+	case COLORSPACE_YUV420P10LE:
+	case COLORSPACE_YUV420P16LE:
+		/* Luma is read in place, only the lines (and in windowed mode
+		 * only the columns) the fingerprint depends on.
+		 */
+		return _video_push_luma(ctx, lumaplane, ctx->inputstride);
+	case COLORSPACE_V210:
+		return _video_push_v210(ctx, lumaplane);
+	default:
+		return -1;
+	}
 }
 
 int klsmpte2064_video_push(void *hdl, const uint8_t *lumaplane)
@@ -139,83 +251,206 @@ int klsmpte2064_video_push(void *hdl, const uint8_t *lumaplane)
 		return -EINVAL;
 	}
 
-	if (ctx->colorspace == COLORSPACE_YUV420P) {
-		/* possible optimization here, make a list of lines we need to process, same as V210. */
-		return _video_push_yuv420p(ctx, lumaplane, ctx->inputstride);
+	uint64_t start = klsmpte2064_governor_start(ctx);
+	int r = _video_push(ctx, lumaplane);
+	if (start) {
+		klsmpte2064_governor_video(ctx, start);
 	}
-	if (ctx->colorspace == COLORSPACE_V210) {
-		return _video_push_v210(ctx, lumaplane);
+
+	return r;
+}
+
+/* The motion compare is already vectorised along the 960 samples of a grid,
+ * batching contexts adds no width to it, and the prefilter streams a whole
+ * frame per context. Contexts are processed back to back.
+ */
+int klsmpte2064_video_push_batch(void *hdls[], const uint8_t *lumaplanes[], uint32_t count, int results[])
+{
+	if (!hdls || !lumaplanes) {
+		return -EINVAL;
+	}
+
+	int ret = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		int r = klsmpte2064_video_push(hdls[i], lumaplanes[i]);
+		if (results) {
+			results[i] = r;
+		}
+		if (r < 0 && ret == 0) {
+			ret = r;
+		}
 	}
 
-	return -1;
+	return ret;
 }
 
-/* Clone the luma plane into our content, and apply -3-2/-1 prefilters
- * per format during the process.
- * TODO: This prefilters the entire frame.
- * technically we only need to do pre-filtering on lines we eventually
- * care about, 16 of them.
+/* Grid capture stream, see klsmpte2064_video_set_grid_capture().
+ * The fingerprint depends on nothing but the 5.2.2 windowed grids, so a
+ * stream of them replays every later step bit exactly:
+ *
+ *  header, once: 'KLGS' | version | progressive | fields | rows | columns | 7 reserved
+ *  record, per frame: 'F' | flags | field 1 grid | field 2 grid, interlaced only
+ *
+ * The record flags carry KLSMPTE2064_CONTAINER_DISCONTINUITY when the history
+ * was reseeded from the frame, a replay reseeds at the same point.
  */
-static int _video_prefilter(struct ctx_s *ctx, const uint8_t *luma, int src_stride)
+#define GRID_STREAM_VERSION 1
+#define GRID_RECORD_TAG 'F'
+
+static void _video_grid_capture(struct ctx_s *ctx, int reseed)
 {
+	uint8_t *rec = &ctx->grid_record[0];
 
-	if (ctx->wss_line_count) {
-		for (int i = 0; i < ctx->wss_line_count; i++) {
-			int h = ctx->wss_lines[i];
-			for (int w = 0; w < ctx->width; w++) {
+	rec[0] = GRID_RECORD_TAG;
+	rec[1] = reseed ? KLSMPTE2064_CONTAINER_DISCONTINUITY : 0;
 
-				uint8_t *dstline = ctx->y + (src_stride * h);
-				uint8_t *srcline = (uint8_t *)luma + (src_stride * h);
-				
-				if (ctx->t1->pfcount == 0) {
+	/* After the last field f4 holds it, and f3 the first field of an interlaced frame */
+	if (ctx->field_count == 2) {
+		memcpy(rec + 2, &ctx->wss_f3[0][0], WSS_SAMPLES_PER_FRAME);
+		memcpy(rec + 2 + WSS_SAMPLES_PER_FRAME, &ctx->wss_f4[0][0], WSS_SAMPLES_PER_FRAME);
+	} else {
+		memcpy(rec + 2, &ctx->wss_f4[0][0], WSS_SAMPLES_PER_FRAME);
+	}
 
-					/* No filtering at all, probably better to memcpy this */
-					dstline[w] = srcline[w];
+	ctx->grid_sink(ctx->grid_opaque, rec, KLSMPTE2064_GRID_RECORD_SIZE(ctx->field_count));
+}
 
-				} else {
+int klsmpte2064_video_set_grid_capture(void *hdl, void (*sink)(void *opaque, const uint8_t *data, uint32_t len), void *opaque)
+{
+	struct ctx_s *ctx = (struct ctx_s *)hdl;
+	if (!ctx) {
+		return -EINVAL;
+	}
 
-					int sum = 0;
-					int samples = 0;
-					for (int i = 0; i < ctx->t1->pfcount; i++) {
-						int xx = w + ctx->t1->prefilter[i];
-						if (xx >= 0 && xx < ctx->width) {
-							sum += srcline[xx];
-							samples++;
-						}
-					}
-					dstline[w] = (uint8_t)(sum / samples);
+	ctx->grid_sink = sink;
+	ctx->grid_opaque = opaque;
+	if (!sink) {
+		return 0;
+	}
 
-				}
-			}
+	uint8_t hdr[KLSMPTE2064_GRID_HEADER_SIZE] = { 'K', 'L', 'G', 'S' };
+	hdr[4] = GRID_STREAM_VERSION;
+	hdr[5] = ctx->progressive ? 1 : 0;
+	hdr[6] = ctx->field_count;
+	hdr[7] = WSS_ROWS;
+	hdr[8] = WSS_SAMPLES_PER_ROW;
+	sink(opaque, hdr, sizeof(hdr));
+
+	return 0;
+}
 
+int klsmpte2064_video_replay_grid(void *hdl, const uint8_t *data, uint32_t len, uint32_t *usedLength)
+{
+	struct ctx_s *ctx = (struct ctx_s *)hdl;
+	if (!ctx || !data || !usedLength) {
+		return -EINVAL;
+	}
+	*usedLength = 0;
+	if (len < 1) {
+		return -EAGAIN;
+	}
+
+	if (data[0] == 'K') {
+		if (len < KLSMPTE2064_GRID_HEADER_SIZE) {
+			return -EAGAIN;
 		}
-	} else {
-		/* Entire frame - AS per the spec. */
-		for (int h = 0; h < ctx->height; h++) {
-			for (int w = 0; w < ctx->width; w++) {
+		if (memcmp(data, "KLGS", 4) != 0 || data[4] != GRID_STREAM_VERSION ||
+			data[7] != WSS_ROWS || data[8] != WSS_SAMPLES_PER_ROW) {
+			return -EBADMSG;
+		}
+		/* Grids from the other scan type would be paired with the wrong history */
+		if (data[5] != (ctx->progressive ? 1 : 0) || data[6] != ctx->field_count) {
+			return -EINVAL;
+		}
+		*usedLength = KLSMPTE2064_GRID_HEADER_SIZE;
+		return 0;
+	}
+
+	if (data[0] != GRID_RECORD_TAG) {
+		return -EBADMSG;
+	}
+	if (len < KLSMPTE2064_GRID_RECORD_SIZE(ctx->field_count)) {
+		return -EAGAIN;
+	}
 
-				uint8_t *dstline = ctx->y + (src_stride * h);
-				uint8_t *srcline = (uint8_t *)luma + (src_stride * h);
-				
-				if (ctx->t1->pfcount == 0) {
+	int reseed = __atomic_exchange_n(&ctx->video_discontinuity, 0, __ATOMIC_ACQUIRE);
+	if (data[1] & KLSMPTE2064_CONTAINER_DISCONTINUITY) {
+		reseed = 1;
+	}
+	if (_video_process_fields(ctx, 0, data + 2, reseed) < 0) {
+		return -EINVAL;
+	}
+	*usedLength = KLSMPTE2064_GRID_RECORD_SIZE(ctx->field_count);
 
-					/* No filtering at all, probably better to memcpy this */
-					dstline[w] = srcline[w];
+	return 1;
+}
 
-				} else {
+/* Fetch the 8 most significant bits of luma pixel x from a source line.
+ * bytes: 1 or 2 byte containers, step: containers between luma pixels,
+ * offset: container of the first luma pixel, shift: bits to discard.
+ * Always inlined with constant arguments, so each colorspace gets its
+ * own specialised kernel.
+ */
+static inline __attribute__((always_inline)) int _video_luma_sample(const uint8_t *line, int x,
+	int bytes, int step, int offset, int shift)
+{
+	if (bytes == 2) {
+		return (((const uint16_t *)line)[(x * step) + offset] >> shift) & 0xff;
+	}
+	return line[(x * step) + offset];
+}
 
-					int sum = 0;
-					int samples = 0;
-					for (int i = 0; i < ctx->t1->pfcount; i++) {
-						int xx = w + ctx->t1->prefilter[i];
-						if (xx >= 0 && xx < ctx->width) {
-							sum += srcline[xx];
-							samples++;
-						}
-					}
-					dstline[w] = (uint8_t)(sum / samples);
+/* Apply the Table 1 horizontal prefilter for a single output pixel. */
+static inline __attribute__((always_inline)) uint8_t _video_prefilter_sample(struct ctx_s *ctx, const uint8_t *srcline, int w,
+	int bytes, int step, int offset, int shift)
+{
+	if (ctx->t1->pfcount == 0) {
+		/* No filtering at all */
+		return _video_luma_sample(srcline, w, bytes, step, offset, shift);
+	}
 
-				}
+	int sum = 0;
+	int samples = 0;
+	for (int i = 0; i < ctx->t1->pfcount; i++) {
+		int xx = w + ctx->t1->prefilter[i];
+		if (xx >= 0 && xx < ctx->width) {
+			sum += _video_luma_sample(srcline, xx, bytes, step, offset, shift);
+			samples++;
+		}
+	}
+
+	return (uint8_t)(sum / samples);
+}
+
+/* Clone the luma plane into our content, and apply -3-2/-1 prefilters
+ * per format during the process.
+ * By default this prefilters the entire frame, as per the spec.
+ * With wss_line_count set, only the lines and columns the subsampling
+ * window reads are filtered, everything else in ctx->y is left stale.
+ */
+static inline __attribute__((always_inline)) int _video_prefilter(struct ctx_s *ctx, const uint8_t *luma, int src_stride,
+	int bytes, int step, int offset, int shift)
+{
+	if (ctx->wss_line_count) {
+		for (int i = 0; i < ctx->wss_line_count; i++) {
+			int h = ctx->wss_lines[i];
+			uint8_t *dstline = ctx->y + (ctx->ystride * h);
+			const uint8_t *srcline = luma + (src_stride * h);
+
+			int gridh = ctx->t2->hstart;
+			for (int c = 0; c < WSS_SAMPLES_PER_ROW; c++) {
+				dstline[gridh] = _video_prefilter_sample(ctx, srcline, gridh, bytes, step, offset, shift);
+				gridh += ctx->t2->hstep;
+			}
+		}
+	} else {
+		/* Entire frame - AS per the spec. */
+		for (int h = 0; h < ctx->height; h++) {
+			uint8_t *dstline = ctx->y + (ctx->ystride * h);
+			const uint8_t *srcline = luma + (src_stride * h);
+
+			for (int w = 0; w < ctx->width; w++) {
+				dstline[w] = _video_prefilter_sample(ctx, srcline, w, bytes, step, offset, shift);
 			}
 		}
 	}
@@ -223,26 +458,57 @@ static int _video_prefilter(struct ctx_s *ctx, const uint8_t *luma, int src_stri
 	return 0;
 }
 
-/* See 5.2.2 and Figure 3 */
-static int _video_window_subsampling_progressive(struct ctx_s *ctx, int src_stride)
+/* YUV420P and NV12 luma, also the V210 intermediate 8 bit plane */
+static int _video_prefilter_8b(struct ctx_s *ctx, const uint8_t *luma, int src_stride)
 {
-	if (!ctx->progressive) {
-		return -1;
-	}
+	return _video_prefilter(ctx, luma, src_stride, 1, 1, 0, 0);
+}
 
-	/* Current to prior, we'll need this later in motion detection.
-	 * We never really use f3 but its clear to read this way.
-	 */
+/* Packed U0 Y0 V0 Y1, luma in the odd bytes */
+static int _video_prefilter_uyvy(struct ctx_s *ctx, const uint8_t *luma, int src_stride)
+{
+	return _video_prefilter(ctx, luma, src_stride, 1, 2, 1, 0);
+}
+
+/* 16 bit little endian containers, 10 bits MSB aligned */
+static int _video_prefilter_p010(struct ctx_s *ctx, const uint8_t *luma, int src_stride)
+{
+	return _video_prefilter(ctx, luma, src_stride, 2, 1, 0, 8);
+}
+
+/* 16 bit little endian containers, 10 bits LSB aligned */
+static int _video_prefilter_yuv420p10le(struct ctx_s *ctx, const uint8_t *luma, int src_stride)
+{
+	return _video_prefilter(ctx, luma, src_stride, 2, 1, 0, 2);
+}
+
+/* Current to prior, we'll need this later in motion detection.
+ * For progressive f2 is the second preceding frame. For interlaced
+ * f3 is the opposite field and f2 the same field in the prior frame.
+ */
+static void _video_window_rotate(struct ctx_s *ctx)
+{
 	memcpy(&ctx->wss_f2[0][0], &ctx->wss_f3[0][0], sizeof(ctx->wss_f3));
 	memcpy(&ctx->wss_f3[0][0], &ctx->wss_f4[0][0], sizeof(ctx->wss_f4));
+}
 
-	/* Subsample the prefiltered luma into a windowed sub-sample area */
-	int gridv = ctx->t2->vstart_f1;
+/* See 5.2.2 and Figure 3.
+ * For interlaced content the rows for each field were cached
+ * during context allocation, see wss_rows.
+ */
+static int _video_window_subsampling(struct ctx_s *ctx, int src_stride, int field)
+{
+	if (field >= ctx->field_count) {
+		return -1;
+	}
 
+	_video_window_rotate(ctx);
+
+	/* Subsample the prefiltered luma into a windowed sub-sample area */
 	for (int r = 0; r < WSS_ROWS; r++) {
 		int gridh = ctx->t2->hstart;
-		uint8_t *srcline = (ctx->y + (gridv * src_stride));
-		//printf(MODULE_PREFIX "gridv %4d: ", gridv);
+		uint8_t *srcline = (ctx->y + (ctx->wss_rows[field][r] * src_stride));
+		//printf(MODULE_PREFIX "gridv %4d: ", ctx->wss_rows[field][r]);
 
 		for (int c = 0; c < WSS_SAMPLES_PER_ROW; c++) {
 			//printf(" %4d", gridh);
@@ -252,10 +518,147 @@ static int _video_window_subsampling_progressive(struct ctx_s *ctx, int src_stri
 			gridh += ctx->t2->hstep;
 		}
 		//printf("\n");
-		gridv += ctx->t2->vstep;
+	}
 
+	return 0;
+}
+
+/* Motion counting kernels.
+ * Each returns the number of bytes where abs(a[i] - b[i]) >= threshold,
+ * threshold being 0..256. The user facing threshold and comparison semantics
+ * are normalized into a >= threshold by _video_motion_threshold_ge().
+ * The 16x60 grid is contiguous, 960 bytes, so the SIMD kernels
+ * walk it as a flat array without any row handling.
+ */
+static int _video_motion_count_c(const uint8_t *a, const uint8_t *b, int count, int threshold)
+{
+	int above_threshold = 0;
+
+	for (int i = 0; i < count; i++) {
+		int diff = (int)a[i] - (int)b[i];
+		if (abs(diff) >= threshold) {
+			above_threshold++;
+		}
 	}
 
+	return above_threshold;
+}
+
+#if HAVE_X86_SIMD
+/* abs(a - b) of unsigned bytes is (a -sat b) | (b -sat a).
+ * x >= t is max(x, t) == x, for unsigned bytes.
+ */
+static int _video_motion_count_sse2(const uint8_t *a, const uint8_t *b, int count, int threshold)
+{
+	if (threshold > 255) {
+		return 0;
+	}
+
+	const __m128i t = _mm_set1_epi8((char)threshold);
+	int above_threshold = 0;
+	int i = 0;
+
+	for (; i + 16 <= count; i += 16) {
+		__m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+		__m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+		__m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+		__m128i ge = _mm_cmpeq_epi8(_mm_max_epu8(d, t), d);
+		above_threshold += __builtin_popcount(_mm_movemask_epi8(ge));
+	}
+
+	return above_threshold + _video_motion_count_c(a + i, b + i, count - i, threshold);
+}
+
+__attribute__((target("avx2,popcnt")))
+static int _video_motion_count_avx2(const uint8_t *a, const uint8_t *b, int count, int threshold)
+{
+	if (threshold > 255) {
+		return 0;
+	}
+
+	const __m256i t = _mm256_set1_epi8((char)threshold);
+	int above_threshold = 0;
+	int i = 0;
+
+	/* 960 bytes, 30 iterations */
+	for (; i + 32 <= count; i += 32) {
+		__m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+		__m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+		__m256i d = _mm256_or_si256(_mm256_subs_epu8(va, vb), _mm256_subs_epu8(vb, va));
+		__m256i ge = _mm256_cmpeq_epi8(_mm256_max_epu8(d, t), d);
+		above_threshold += __builtin_popcount((uint32_t)_mm256_movemask_epi8(ge));
+	}
+
+	return above_threshold + _video_motion_count_c(a + i, b + i, count - i, threshold);
+}
+#endif /* HAVE_X86_SIMD */
+
+/* Pick the luma reader for the colorspace, and the fastest
+ * kernels the host cpu supports.
+ */
+void klsmpte2064_video_select_kernels(struct ctx_s *ctx)
+{
+	switch (ctx->colorspace) {
+	case COLORSPACE_UYVY:
+		ctx->prefilter = _video_prefilter_uyvy;
+		break;
+	case COLORSPACE_P010:
+	case COLORSPACE_YUV420P16LE:
+		/* Both keep the 8 MSBs in the top byte of each 16 bit container */
+		ctx->prefilter = _video_prefilter_p010;
+		break;
+	case COLORSPACE_YUV420P10LE:
+		ctx->prefilter = _video_prefilter_yuv420p10le;
+		break;
+	default:
+		ctx->prefilter = _video_prefilter_8b;
+	}
+
+	ctx->motion_count = _video_motion_count_c;
+#if HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+		ctx->motion_count = _video_motion_count_avx2;
+	} else if (__builtin_cpu_supports("sse2")) {
+		ctx->motion_count = _video_motion_count_sse2;
+	}
+#endif
+}
+
+/* Normalize the configured threshold and comparison into a >= threshold. */
+static int _video_motion_threshold_ge(struct ctx_s *ctx)
+{
+	if (ctx->motion_compare == MOTION_COMPARE_GREATER_EQUAL) {
+		return ctx->per_pixel_motion_threshold;
+	}
+	return ctx->per_pixel_motion_threshold + 1;
+}
+
+int klsmpte2064_video_signal_discontinuity(void *hdl)
+{
+	struct ctx_s *ctx = (struct ctx_s *)hdl;
+	if (!ctx) {
+		return -EINVAL;
+	}
+
+	__atomic_store_n(&ctx->video_discontinuity, 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+int klsmpte2064_video_set_motion_threshold(void *hdl, uint32_t threshold, enum klsmpte2064_motion_compare_e compare)
+{
+	struct ctx_s *ctx = (struct ctx_s *)hdl;
+	if (!ctx || threshold > 255) {
+		return -EINVAL;
+	}
+	if (compare != MOTION_COMPARE_GREATER_THAN && compare != MOTION_COMPARE_GREATER_EQUAL) {
+		return -EINVAL;
+	}
+
+	ctx->per_pixel_motion_threshold = threshold;
+	ctx->motion_compare = compare;
+
 	return 0;
 }
 
@@ -267,17 +670,12 @@ static int _video_window_subsampling_progressive(struct ctx_s *ctx, int src_stri
  */
 static int _video_window_compute_motion(struct ctx_s *ctx)
 {
-	int above_threshold = 0;
+	/* The library historically used '>', the spec wording is '>='.
+	 * Callers choose via klsmpte2064_video_set_motion_threshold().
+	 */
+	int above_threshold = ctx->motion_count(&ctx->wss_f4[0][0], &ctx->wss_f2[0][0],
+		WSS_SAMPLES_PER_FRAME, _video_motion_threshold_ge(ctx));
 
-	for (int r = 0; r < WSS_ROWS; r++) {
-		for (int c = 0; c < WSS_SAMPLES_PER_ROW; c++) {
-			int diff = (int)ctx->wss_f4[r][c] - (int)ctx->wss_f2[r][c];
-			int adiff = abs(diff);
-			if (adiff > ctx->per_pixel_motion_threshold) {
-				above_threshold++;
-			}
-		}
-	}
 	ctx->fingerprints_calculated++;
 
 	/* "the count of
@@ -287,7 +685,7 @@ static int _video_window_compute_motion(struct ctx_s *ctx)
 	ctx->video_fingerprint_data_f3 = ctx->video_fingerprint_data_f4;
 	ctx->video_fingerprint_data_f4 = above_threshold / 4;
 
-	if (ctx->verbose) {
+	if (klsmpte2064_verbose(ctx)) {
 		printf(MODULE_PREFIX "frame %8" PRIu64 " - video fp 0x%02x, pixels are above threshold %3d/%3d\n",
 			ctx->fingerprints_calculated,
 			ctx->video_fingerprint_data_f4,
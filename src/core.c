@@ -14,27 +14,30 @@ int klsmpte2064_context_alloc(void **hdl,
 	uint32_t stride,
 	uint32_t bitdepth)
 {
-	if (!colorspace || !width || !height || !stride || (bitdepth != 8 && bitdepth != 10) || progressive != 1) {
+	return klsmpte2064_context_alloc_ex(hdl, colorspace, progressive, width, height, stride, bitdepth, NULL);
+}
+
+int klsmpte2064_context_alloc_ex(void **hdl,
+	enum klsmpte2064_colorspace_e colorspace,
+	uint32_t progressive,
+	uint32_t width,
+	uint32_t height,
+	uint32_t stride,
+	uint32_t bitdepth,
+	const struct klsmpte2064_context_params_s *params)
+{
+	if (!hdl || !colorspace || colorspace >= COLORSPACE_MAX || !width || !height || !stride || (bitdepth != 8 && bitdepth != 10 && bitdepth != 16) || progressive > 1) {
 		return -EINVAL;
 	}
 
-	struct ctx_s *ctx = calloc(1, sizeof(*ctx));
-	if (!ctx) {
-		return -ENOMEM;
+	struct ctx_s *ctx;
+	int r = klsmpte2064_context_mem_alloc(&ctx, params);
+	if (r < 0) {
+		return r;
 	}
+	klsmpte2064_align_init(ctx);
 
 	ctx->ystride = width;
-	ctx->y = malloc(width * height);
-	if (!ctx->y) {
-		fprintf(stderr, MODULE_PREFIX "unable to allocate luma frame, aborting.\n");
-		exit(0);
-	}
-	ctx->y_csc = malloc(width * height);
-	if (!ctx->y_csc) {
-		fprintf(stderr, MODULE_PREFIX "unable to allocate luma frame, aborting.\n");
-		exit(0);
-	}
-
 	ctx->colorspace = colorspace;
 	ctx->width = width;
 	ctx->height = height;
@@ -42,43 +45,93 @@ int klsmpte2064_context_alloc(void **hdl,
 	ctx->inputstride = stride;
 	ctx->progressive = progressive;
 	ctx->per_pixel_motion_threshold = 32;
+	ctx->motion_compare = MOTION_COMPARE_GREATER_THAN;
 	ctx->audioMaxSampleCount = 2200;
+	ctx->sample_rate = AUDIO_SAMPLE_RATE;
+	ctx->decimate = 1;
+	ctx->silence_level = 0.001f; /* -60dBFS */
+
+	/* A known frame rate fixes Table 3 up front, rather than learning it from the
+	 * first audio push. Video only contexts need it for Picture_Rate.
+	 */
+	if (params && params->frameRate) {
+		ctx->t3 = lookupTable3PictureRate(params->frameRate);
+		if (!ctx->t3) {
+			klsmpte2064_context_free(ctx);
+			return -EINVAL;
+		}
+		ctx->frame_rate = params->frameRate;
+		ctx->timebase_num = ctx->t3->timebase_num;
+		ctx->timebase_den = ctx->t3->timebase_den;
+	}
+	klsmpte2064_encapsulation_init(ctx);
 
 	ctx->t1 = lookupTable1(progressive, width, height);
 	if (!ctx->t1) {
-		free(ctx);
+		klsmpte2064_context_free(ctx);
 		return -EINVAL;
 	}
 
 	ctx->t2 = lookupTable2(progressive, width, height);
 	if (!ctx->t2) {
-		free(ctx);
+		klsmpte2064_context_free(ctx);
 		return -EINVAL;
 	}
 
-	/* Progressive only - cache a list of line numbers in each frame.
+	/* Cache a list of line numbers in each frame.
 	 * used for large algorithm acceleration.
 	 */
-	int gridv = ctx->t2->vstart_f1;
-	for (int r = 0; r < WSS_ROWS; r++) {
-		ctx->wss_lines[r] = gridv;
-		gridv += ctx->t2->vstep;
+	if (progressive) {
+		ctx->field_count = 1;
+		int gridv = ctx->t2->vstart_f1;
+		for (int r = 0; r < WSS_ROWS; r++) {
+			ctx->wss_rows[0][r] = gridv;
+			ctx->wss_lines[r] = gridv;
+			gridv += ctx->t2->vstep;
+		}
+	} else {
+		/* Table 2 field 1 coordinates are field lines. Field 2 coordinates
+		 * are numbered from the first line of field 2 in the interface raster
+		 * (563 for 1125 line systems), vstart_f2 - vstart_f1 is that offset.
+		 * Translate both into rows of the interleaved frame, field 1 on even rows.
+		 */
+		ctx->field_count = 2;
+		int f2_offset = ctx->t2->vstart_f2 - ctx->t2->vstart_f1;
+		int gridv1 = ctx->t2->vstart_f1;
+		int gridv2 = ctx->t2->vstart_f2 - f2_offset;
+		for (int r = 0; r < WSS_ROWS; r++) {
+			ctx->wss_rows[0][r] = (gridv1 * 2);
+			ctx->wss_rows[1][r] = (gridv2 * 2) + 1;
+			ctx->wss_lines[(r * 2) + 0] = ctx->wss_rows[0][r];
+			ctx->wss_lines[(r * 2) + 1] = ctx->wss_rows[1][r];
+			gridv1 += ctx->t2->vstep;
+			gridv2 += ctx->t2->vstep;
+		}
+		if (ctx->wss_rows[1][WSS_ROWS - 1] >= height) {
+			klsmpte2064_context_free(ctx);
+			return -EINVAL;
+		}
 	}
 #if 0
 	/* Enable this line to accelerate the algorithm. It will only colorspace convert
 	 * and prefilter lines it needs to process, and ignore those that don't impact
 	 * the finger print calculation.
 	 */
-	ctx->wss_line_count = WSS_ROWS;
+	ctx->wss_line_count = WSS_ROWS * ctx->field_count;
 #else
 	/* Implement the 2064 spec failfully, colorspace convert all lines
 	 * and pre-filter the entire frame.
 	 */
 	ctx->wss_line_count = 0; 
 #endif
-	ctx->bs = klbs_alloc();
+	klsmpte2064_video_select_kernels(ctx);
 
-	klsmpte2064_audio_alloc(ctx);
+	/* Size the scratch up front, so the push calls don't allocate */
+	if (klsmpte2064_video_bind(ctx) < 0 || klsmpte2064_audio_bind(ctx, 0) < 0 ||
+		klsmpte2064_audio_stream_alloc(ctx) < 0) {
+		klsmpte2064_context_free(ctx);
+		return -ENOMEM;
+	}
 
 	*hdl = ctx;
 	return 0; /* Success */
@@ -87,12 +140,13 @@ int klsmpte2064_context_alloc(void **hdl,
 void klsmpte2064_context_free(void *hdl)
 {
 	struct ctx_s *ctx = (struct ctx_s *)hdl;
+	if (!ctx) {
+		return;
+	}
 
-	klsmpte2064_audio_free(ctx);
-	klbs_free(ctx->bs);
-	free(ctx->y_csc);
-	free(ctx->y);
-	free(ctx);
+	klsmpte2064_align_free(ctx);
+	klsmpte2064_audio_stream_free(ctx);
+	klsmpte2064_context_mem_free(ctx);
 }
 
 int klsmpte2064_context_set_verbose(void *hdl, int level)
@@ -0,0 +1,100 @@
+/**
+ * @file	core-anc.h
+ * @author	Steven Toth <stoth@kernellabs.com>
+ * @copyright	Copyright (c) 2025 Kernel Labs Inc. All Rights Reserved.
+ * @brief	Containers carried as SMPTE 291 ancillary data packets, Eg. in SDI VANC
+ */
+
+#ifndef _LIBKLSMPTE2064_CORE_ANC_H
+#define _LIBKLSMPTE2064_CORE_ANC_H
+
+#include <stdint.h>
+#include <stdarg.h>
+#include <sys/errno.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A type 2 packet: ADF (3 words), DID, SDID, DC, up to 255 UDW, CS */
+#define KLSMPTE2064_ANC_WORDS(len) (7 + (len))
+
+/* Widest V210 line klsmpte2064_anc_parse_v210() accepts, in pixels */
+#define KLSMPTE2064_ANC_V210_WIDTH_MAX 4096
+
+/**
+ * @brief	    Build a SMPTE 291 type 2 ANC packet carrying a container, Eg. from klsmpte2064_encapsulation_pack(),
+ *              as 10 bit words: ADF, DID, SDID, DC, one user data word per container byte and the checksum,
+ *              each with its b8 even parity and b9 inverse bits.
+ * @param[in]	uint8_t - DID, as registered for the deployment
+ * @param[in]	uint8_t - SDID
+ * @param[in]	const uint8_t * - container
+ * @param[in]	uint32_t - container length, 1 - 255 bytes
+ * @param[out]	uint16_t * - words, KLSMPTE2064_ANC_WORDS(len) long
+ * @param[in]	uint32_t - number of words available
+ * @return      > 0 - Number of words written
+ * @return      -ENOSPC - Not enough words
+ * @return      < 0 - Error
+ */
+int klsmpte2064_anc_build(uint8_t did, uint8_t sdid, const uint8_t *data, uint32_t len, uint16_t *words, uint32_t wordCount);
+
+/**
+ * @brief	    As klsmpte2064_anc_build(), packing the words straight into the luma samples of a V210 VANC line,
+ *              Eg. a line of a Decklink output frame, with no intermediate buffer. Chroma and the luma
+ *              samples outside the packet are left untouched, initialise the line to blanking first.
+ * @param[in]	uint8_t - DID
+ * @param[in]	uint8_t - SDID
+ * @param[in]	const uint8_t * - container
+ * @param[in]	uint32_t - container length, 1 - 255 bytes
+ * @param[out]	uint32_t * - V210 line, 32 bit aligned
+ * @param[in]	uint32_t - line width in pixels, Eg. 1920
+ * @param[in]	uint32_t - first luma sample of the packet, Eg. 0
+ * @return      > 0 - Number of luma samples written
+ * @return      -ENOSPC - The packet doesn't fit the line
+ * @return      < 0 - Error
+ */
+int klsmpte2064_anc_pack_v210(uint8_t did, uint8_t sdid, const uint8_t *data, uint32_t len,
+	uint32_t *line, uint32_t width, uint32_t offset);
+
+/**
+ * @brief	    Find the first ANC packet with a matching DID and SDID in a run of 10 bit words and
+ *              recover its container. Packets for other DIDs are skipped.
+ * @param[in]	const uint16_t * - words
+ * @param[in]	uint32_t - number of words
+ * @param[in]	uint8_t - DID
+ * @param[in]	uint8_t - SDID
+ * @param[out]	uint8_t * - container
+ * @param[in]	uint32_t - container buffer length in bytes
+ * @param[out]	uint32_t * - container length
+ * @return      0 - Success
+ * @return      -ENODATA - No matching packet
+ * @return      -EBADMSG - Parity or checksum error
+ * @return      -ENOSPC - Container buffer too small
+ * @return      < 0 - Error
+ */
+int klsmpte2064_anc_parse(const uint16_t *words, uint32_t wordCount, uint8_t did, uint8_t sdid,
+	uint8_t *data, uint32_t len, uint32_t *usedLength);
+
+/**
+ * @brief	    As klsmpte2064_anc_parse(), reading the luma samples of a V210 VANC line, Eg. captured by Decklink.
+ * @param[in]	const uint32_t * - V210 line, 32 bit aligned
+ * @param[in]	uint32_t - line width in pixels, up to KLSMPTE2064_ANC_V210_WIDTH_MAX
+ * @param[in]	uint8_t - DID
+ * @param[in]	uint8_t - SDID
+ * @param[out]	uint8_t * - container
+ * @param[in]	uint32_t - container buffer length in bytes
+ * @param[out]	uint32_t * - container length
+ * @return      0 - Success
+ * @return      -ENODATA - No matching packet
+ * @return      -EBADMSG - Parity or checksum error
+ * @return      -ENOSPC - Container buffer too small
+ * @return      < 0 - Error
+ */
+int klsmpte2064_anc_parse_v210(const uint32_t *line, uint32_t width, uint8_t did, uint8_t sdid,
+	uint8_t *data, uint32_t len, uint32_t *usedLength);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* _LIBKLSMPTE2064_CORE_ANC_H */
@@ -25,15 +25,142 @@ enum klsmpte2064_audio_type_e
     AUDIOTYPE_MAX
 };
 
+#define KLSMPTE2064_AUDIO_PROGRAMS_MAX 16
+#define KLSMPTE2064_AUDIO_PROGRAM_CHANNELS_MAX 16
+#define KLSMPTE2064_AUDIO_INPUT_CHANNELS_MAX 64
+
+/* Flags for klsmpte2064_audio_set_samplerate() */
+#define KLSMPTE2064_AUDIO_SAMPLERATE_DECIMATE (1 << 0) /**< Decimate high rates to 44.1/48KHz during the downmix. */
+
+/**
+ * @brief	Input sample formats accepted by klsmpte2064_audio_downmix_push().
+ */
+enum klsmpte2064_sample_format_e
+{
+    SAMPLEFORMAT_UNDEFINED = 0,
+    SAMPLEFORMAT_S16,      /**< Signed 16bit, native endian. */
+    SAMPLEFORMAT_S24LE,    /**< Signed 24bit packed in 3 bytes, little endian. */
+    SAMPLEFORMAT_S24BE,    /**< Signed 24bit packed in 3 bytes, big endian. Eg. AES67 / RTP L24 */
+    SAMPLEFORMAT_S32,      /**< Signed 32bit, native endian. Eg. Decklink */
+    SAMPLEFORMAT_MAX
+};
+
+/**
+ * @brief	Arithmetic used by the envelope, mean and comparator steps (5.3.3 - 5.3.5).
+ *          The fixed point pipelines run on 32bit integers with shifts in place of divides,
+ *          their fingerprints are bit identical on any compiler or CPU, for correlating
+ *          fingerprints generated at different sites.
+ */
+enum klsmpte2064_audio_pipeline_e
+{
+    AUDIO_PIPELINE_FLOAT = 0,  /**< Default. Float detectors with the tuned alpha/beta filters. */
+    AUDIO_PIPELINE_FIXED,      /**< The tuned alpha/beta filters in Q30 fixed point. */
+    AUDIO_PIPELINE_FIXED_SPEC, /**< The Km/Ke integer detectors as written in 5.3.3/5.3.4, Km 8192, Ke 256. */
+    AUDIO_PIPELINE_MAX
+};
+
+/**
+ * @brief	Level metrics of the most recent frame fingerprinted in a slot, a legacy audio
+ *          type or a program. Measured on the downmixed mono analysis signal as it's
+ *          rectified for 5.3.2, clipping on the input channels as they're downmixed.
+ */
+struct klsmpte2064_audio_levels_s
+{
+    uint64_t frames;          /**< Frames measured in the slot since allocation, 0 before the first. */
+    float peak;               /**< Highest rectified sample, 1.0 is full scale. */
+    float mean;               /**< Mean rectified level, the level the 5.3.3 envelope tracks. */
+    uint32_t silenceFrames;   /**< Consecutive frames with a peak at or below the silence level, including this one. */
+    uint32_t clippedSamples;  /**< Input samples at full scale, on any channel mixed into the slot. */
+};
+
+/**
+ * @brief	Describes a single audio program, a group of interleaved input channels
+ *          mixed down to mono and fingerprinted independently.
+ */
+struct klsmpte2064_audio_program_s
+{
+    uint32_t channelCount;                                        /**< Number of input channels in the group. */
+    uint32_t channels[KLSMPTE2064_AUDIO_PROGRAM_CHANNELS_MAX];    /**< Input channel index of each group member, 0 based. */
+    float coefficients[KLSMPTE2064_AUDIO_PROGRAM_CHANNELS_MAX];   /**< Mix gain of each group member, Eg. 0.3535 for a stereo pair. */
+    uint8_t mixType;                                              /**< AudioMixType for the container, 0 .. 7. Eg. 0x02 from 2.0, 0x05 from 5.1 */
+};
+
+/**
+ * @brief	    Set the input sample rate for every audio push call, 48KHz by default.
+ *              The decimator factor and detector time constants are derived from the rate
+ *              and frame rate, so 44.1KHz or 96KHz sources need no external resampling.
+ *              With KLSMPTE2064_AUDIO_SAMPLERATE_DECIMATE, rates of 88.2KHz and above are
+ *              reduced by an integer factor with a cheap polyphase filter as they're downmixed,
+ *              halving (or better) the per sample fingerprint cost.
+ *              Sample counts passed to the push calls are always at the input rate.
+ *              Call from the audio push thread, or before pushing. Resets any streamed audio.
+ * @param[in]	void * - A previously allocated content/handle
+ * @param[in]	uint32_t sampleRate - 8000 .. 192000, Eg. 44100 or 96000
+ * @param[in]	uint32_t flags - 0 or KLSMPTE2064_AUDIO_SAMPLERATE_DECIMATE
+ * @return      0 - Success
+ * @return      < 0 - Error
+ */
+int klsmpte2064_audio_set_samplerate(void *hdl, uint32_t sampleRate, uint32_t flags);
+
+/**
+ * @brief	    Select the arithmetic for the audio detectors, AUDIO_PIPELINE_FLOAT by default.
+ *              Every pipeline starts from the same downmixed samples, quantized to 15bit
+ *              magnitudes (0 .. 32767) for the fixed point pipelines. The Km/Ke constants of
+ *              AUDIO_PIPELINE_FIXED_SPEC are per 48KHz sample, they aren't rescaled for other rates.
+ *              Call from the audio push thread, or before pushing.
+ * @param[in]	void * - A previously allocated content/handle
+ * @param[in]	enum klsmpte2064_audio_pipeline_e - Eg. AUDIO_PIPELINE_FIXED
+ * @return      0 - Success
+ * @return      < 0 - Error
+ */
+int klsmpte2064_audio_set_pipeline(void *hdl, enum klsmpte2064_audio_pipeline_e pipeline);
+
+/**
+ * @brief	    Set the peak level at or below which a frame counts as silent, -60dBFS by default.
+ *              Call from the audio push thread, or before pushing.
+ * @param[in]	void * - A previously allocated content/handle
+ * @param[in]	float dbfs - -120.0 .. 0.0, Eg. -70.0
+ * @return      0 - Success
+ * @return      < 0 - Error
+ */
+int klsmpte2064_audio_set_silence_level(void *hdl, float dbfs);
+
+/**
+ * @brief	    Fetch the level metrics of the last frame fingerprinted for a legacy audio type,
+ *              pushed via klsmpte2064_audio_push(), _push_batch() or _stream_push().
+ *              May be called from any thread.
+ * @param[in]	void * - A previously allocated content/handle
+ * @param[in]	enum klsmpte2064_audio_type_e - Eg. AUDIOTYPE_STEREO_S16P
+ * @param[out]	struct klsmpte2064_audio_levels_s * - The metrics.
+ * @return      0 - Success
+ * @return      -EAGAIN - Nothing has been fingerprinted for the type yet.
+ * @return      < 0 - Error
+ */
+int klsmpte2064_audio_levels_query(void *hdl, enum klsmpte2064_audio_type_e type, struct klsmpte2064_audio_levels_s *levels);
+
+/**
+ * @brief	    Fetch the level metrics of the last frame fingerprinted for a program,
+ *              see klsmpte2064_audio_set_programs(). May be called from any thread.
+ * @param[in]	void * - A previously allocated content/handle
+ * @param[in]	uint32_t program - 0 based index into the configured programs.
+ * @param[out]	struct klsmpte2064_audio_levels_s * - The metrics.
+ * @return      0 - Success
+ * @return      -EAGAIN - Nothing has been fingerprinted for the program yet.
+ * @return      < 0 - Error
+ */
+int klsmpte2064_audio_program_levels_query(void *hdl, uint32_t program, struct klsmpte2064_audio_levels_s *levels);
+
 /**
  * @brief	    Push an audio frame into the solution for processing.
- *              Support for 48KHz signed.
+ *              Support for 48KHz signed, see klsmpte2064_audio_set_samplerate() for other rates.
  *              Sample count should never technically exceed 2200, it's yypically 800/801
  *              for 59.94 framerate video. The timebase 1001/60000 is important, don't abuse this.
+ *              May be called concurrently with the video push and pack calls from other threads,
+ *              but only one thread may push audio into a context at a time.
  * @param[in]	void * - A previously allocated content/handle
  * @param[in]	enum klsmpte2064_audio_type_e - Eg. AUDIOTYPE_STEREO_S16P
- * @param[in]	uint32_t timebase_num - Eg. 1 or 1001
- * @param[in]	uint32_t timebase_den - Eg. 60 or 60000
+ * @param[in]	uint32_t timebase_num - Eg. 1 or 1001. 0 when the context was allocated with a frameRate.
+ * @param[in]	uint32_t timebase_den - Eg. 60 or 60000. 0 when the context was allocated with a frameRate.
  * @param[in]	const uint16_t **planes - Array of audio planes.
  * @param[in]	uint32_t planeCount - number of planes in array
  * @param[in]	uint32_t samples - (per channel) in the planes. 
@@ -44,6 +171,140 @@ int klsmpte2064_audio_push(void *hdl, enum klsmpte2064_audio_type_e type,
     uint32_t timebase_num, uint32_t timebase_den,
     const int16_t *planes[], uint32_t planeCount, uint32_t sampleCount);
 
+/**
+ * @brief	    Push one audio frame into each of several contexts, Eg. every channel on a host
+ *              once per frame period. Produces the same fingerprints as klsmpte2064_audio_push()
+ *              per context, but contexts are grouped by pipeline and processed eight at a time,
+ *              their envelope and mean detectors advancing side by side in SIMD lanes.
+ *              Contexts may share a scratch.
+ * @param[in]	void *[] - Array of previously allocated contexts/handles
+ * @param[in]	enum klsmpte2064_audio_type_e - Eg. AUDIOTYPE_STEREO_S16P, the same for every context
+ * @param[in]	uint32_t timebase_num - Eg. 1 or 1001. 0 when the context was allocated with a frameRate.
+ * @param[in]	uint32_t timebase_den - Eg. 60 or 60000. 0 when the context was allocated with a frameRate.
+ * @param[in]	const int16_t **[] - The array of audio planes for each context.
+ * @param[in]	uint32_t planeCount - number of planes in each array
+ * @param[in]	const uint32_t [] - samples (per channel) for each context.
+ * @param[in]	uint32_t count - Number of contexts.
+ * @param[out]	int [] - Result of each push (optional).
+ * @return      0 - Success
+ * @return      < 0 - The first error, see results for which contexts failed.
+ */
+int klsmpte2064_audio_push_batch(void *hdls[], enum klsmpte2064_audio_type_e type,
+    uint32_t timebase_num, uint32_t timebase_den,
+    const int16_t **planes[], uint32_t planeCount, const uint32_t sampleCounts[],
+    uint32_t count, int results[]);
+
+/**
+ * @brief	    Configure the audio programs fingerprinted by klsmpte2064_audio_programs_push().
+ *              Each program gets its own fingerprint in every container, after any fingerprints
+ *              from klsmpte2064_audio_push(). Call from the audio push thread, or before pushing.
+ * @param[in]	void * - A previously allocated content/handle
+ * @param[in]	const struct klsmpte2064_audio_program_s * - Array of program descriptors.
+ * @param[in]	uint32_t programCount - Number of programs, 0 .. KLSMPTE2064_AUDIO_PROGRAMS_MAX. 0 disables programs.
+ * @return      0 - Success
+ * @return      < 0 - Error
+ */
+int klsmpte2064_audio_set_programs(void *hdl, const struct klsmpte2064_audio_program_s *programs, uint32_t programCount);
+
+/**
+ * @brief	    Push a video frames worth of interleaved S32 audio and fingerprint every configured program
+ *              in a single pass over the samples. Eg. Decklink native 16 channel audio.
+ * @param[in]	void * - A previously allocated content/handle
+ * @param[in]	uint32_t timebase_num - Eg. 1 or 1001. 0 when the context was allocated with a frameRate.
+ * @param[in]	uint32_t timebase_den - Eg. 60 or 60000. 0 when the context was allocated with a frameRate.
+ * @param[in]	const int32_t *samples - Interleaved samples.
+ * @param[in]	uint32_t channelCount - Channels per interleaved sample, Eg. 16
+ * @param[in]	uint32_t sampleCount - (per channel) in the buffer.
+ * @return      0 - Success
+ * @return      < 0 - Error
+ */
+int klsmpte2064_audio_programs_push(void *hdl, uint32_t timebase_num, uint32_t timebase_den,
+    const int32_t *samples, uint32_t channelCount, uint32_t sampleCount);
+
+/**
+ * @brief	    Configure the input layout for klsmpte2064_audio_downmix_push() and the audio programs
+ *              mixed from it. The programs are compiled into a downmix matrix once, here, so any
+ *              channel layout (Eg. 16ch SDI, 8ch AES67, 5.1+2.0) is handled by a single push path.
+ *              Replaces any programs previously set with klsmpte2064_audio_set_programs().
+ *              Call from the audio push thread, or before pushing.
+ * @param[in]	void * - A previously allocated content/handle
+ * @param[in]	enum klsmpte2064_sample_format_e format - Eg. SAMPLEFORMAT_S24BE
+ * @param[in]	uint32_t planar - 1 when each channel is in its own plane, 0 when interleaved.
+ * @param[in]	uint32_t channelCount - Input channels, 1 .. KLSMPTE2064_AUDIO_INPUT_CHANNELS_MAX
+ * @param[in]	const struct klsmpte2064_audio_program_s * - Array of program descriptors.
+ * @param[in]	uint32_t programCount - Number of programs, 1 .. KLSMPTE2064_AUDIO_PROGRAMS_MAX.
+ * @return      0 - Success
+ * @return      < 0 - Error
+ */
+int klsmpte2064_audio_set_downmix(void *hdl, enum klsmpte2064_sample_format_e format, uint32_t planar,
+    uint32_t channelCount, const struct klsmpte2064_audio_program_s *programs, uint32_t programCount);
+
+/**
+ * @brief	    Push a video frames worth of audio in the layout given to klsmpte2064_audio_set_downmix()
+ *              and fingerprint every program. Each referenced input sample is read once.
+ * @param[in]	void * - A previously allocated content/handle
+ * @param[in]	uint32_t timebase_num - Eg. 1 or 1001. 0 when the context was allocated with a frameRate.
+ * @param[in]	uint32_t timebase_den - Eg. 60 or 60000. 0 when the context was allocated with a frameRate.
+ * @param[in]	const void *planes[] - One plane per channel when planar, else a single interleaved plane.
+ * @param[in]	uint32_t sampleCount - (per channel) in the planes.
+ * @return      0 - Success
+ * @return      < 0 - Error
+ */
+int klsmpte2064_audio_downmix_push(void *hdl, uint32_t timebase_num, uint32_t timebase_den,
+    const void *planes[], uint32_t sampleCount);
+
+/**
+ * @brief	    Push an arbitrary number of audio samples into the solution for processing.
+ *              Unlike klsmpte2064_audio_push() the samples need not align with video frames,
+ *              they are accumulated per audio type and a fingerprint is produced each time
+ *              a video frames worth of samples has arrived, following the sample
+ *              cadence of the input rate for the timebase (Eg. 1601/1602 at 48KHz 29.97). Never allocates memory.
+ *              Don't mix calls to this and klsmpte2064_audio_push() for the same type.
+ * @param[in]	void * - A previously allocated content/handle
+ * @param[in]	enum klsmpte2064_audio_type_e - Eg. AUDIOTYPE_STEREO_S32_CH16_DECKLINK
+ * @param[in]	uint32_t timebase_num - Eg. 1 or 1001. 0 when the context was allocated with a frameRate.
+ * @param[in]	uint32_t timebase_den - Eg. 60 or 60000. 0 when the context was allocated with a frameRate.
+ * @param[in]	const uint16_t **planes - Array of audio planes.
+ * @param[in]	uint32_t planeCount - number of planes in array
+ * @param[in]	uint32_t samples - (per channel) in the planes, any value.
+ * @return      >= 0 - Success, the number of fingerprints completed during this call.
+ * @return      < 0 - Error
+ */
+int klsmpte2064_audio_stream_push(void *hdl, enum klsmpte2064_audio_type_e type,
+    uint32_t timebase_num, uint32_t timebase_den,
+    const int16_t *planes[], uint32_t planeCount, uint32_t sampleCount);
+
+/**
+ * @brief	    Signal that audio was lost before the next push, Eg. dropped capture frames.
+ *              Partially accumulated klsmpte2064_audio_stream_push() frames and any
+ *              decimation history are discarded, streaming restarts on the next sample pushed.
+ *              Call from the audio push thread.
+ * @param[in]	void * - A previously allocated content/handle
+ * @return      0 - Success
+ * @return      < 0 - Error
+ */
+int klsmpte2064_audio_signal_discontinuity(void *hdl);
+
+/**
+ * @brief	    Push a timestamped audio frame into the solution for processing.
+ *              Same as klsmpte2064_audio_push(), the fingerprint is paired with the video
+ *              frame whose PTS is within half a frame of the audio PTS.
+ *              May be called from a different thread to klsmpte2064_video_push_pts().
+ * @param[in]	void * - A previously allocated content/handle
+ * @param[in]	enum klsmpte2064_audio_type_e - Eg. AUDIOTYPE_STEREO_S16P
+ * @param[in]	uint32_t timebase_num - Eg. 1 or 1001. 0 when the context was allocated with a frameRate.
+ * @param[in]	uint32_t timebase_den - Eg. 60 or 60000. 0 when the context was allocated with a frameRate.
+ * @param[in]	const uint16_t **planes - Array of audio planes.
+ * @param[in]	uint32_t planeCount - number of planes in array
+ * @param[in]	uint32_t samples - (per channel) in the planes.
+ * @param[in]	int64_t pts - Presentation timestamp of the first sample, 90KHz clock.
+ * @return      0 - Success
+ * @return      < 0 - Error
+ */
+int klsmpte2064_audio_push_pts(void *hdl, enum klsmpte2064_audio_type_e type,
+    uint32_t timebase_num, uint32_t timebase_den,
+    const int16_t *planes[], uint32_t planeCount, uint32_t sampleCount, int64_t pts);
+
 #ifdef __cplusplus
 };
 #endif
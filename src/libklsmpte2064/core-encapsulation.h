@@ -16,9 +16,21 @@
 extern "C" {
 #endif
 
+/* Container status, library specific. Carried as a third byte of the ID sub container
+ * data, after 'K' 'L', only when non zero. Containers without it are unaffected.
+ */
+#define KLSMPTE2064_CONTAINER_DISCONTINUITY (1 << 0) /**< First frame after a discontinuity, no video fingerprint. */
+#define KLSMPTE2064_CONTAINER_RESYNC        (1 << 1) /**< Video fingerprint measured against the preceding frame, not the second preceding. */
+#define KLSMPTE2064_CONTAINER_AUDIO_ABSENT  (1 << 2) /**< Emitted before some expected audio arrived, it follows in a LATE_AUDIO container. */
+#define KLSMPTE2064_CONTAINER_LATE_AUDIO    (1 << 3) /**< Audio only, completes the previous AUDIO_ABSENT container. */
+
 /**
  * @brief	    Create a 'container' section describing all of the audio and video fingerprints.
  *              This is then typically embeded into a ISO13818-1 PES or other means of distribution.
+ *              Reads a consistent snapshot of the most recently published audio and video fingerprints,
+ *              safe to call while other threads push audio and video.
+ *              After a video discontinuity a container is produced without a video fingerprint,
+ *              see klsmpte2064_video_signal_discontinuity().
  * @param[in]	void * - A previously allocated content/handle
  * @param[in]   uint8_t * - user supplied buffer a minimum of 256 bytes long
  * @param[in]   uint32_t - buffer length in bytes
@@ -28,6 +40,47 @@ extern "C" {
  */
 int klsmpte2064_encapsulation_pack(void *hdl, uint8_t *data, uint32_t len, uint32_t *usedLength);
 
+/**
+ * @brief	    Create a 'container' for the oldest frame in the alignment buffer, fed by
+ *              klsmpte2064_video_push_pts() and klsmpte2064_audio_push_pts().
+ *              A frame is ready once its video and all of the audio types seen so far have arrived.
+ *              Call repeatedly until -ENODATA is returned. Call from a single thread only.
+ * @param[in]	void * - A previously allocated content/handle
+ * @param[in]   uint8_t * - user supplied buffer a minimum of 256 bytes long
+ * @param[in]   uint32_t - buffer length in bytes
+ * @param[out]  uint32_t * - number of bufer bytes used
+ * @param[out]  int64_t * - Video PTS of the frame the container describes (optional).
+ * @return      0 - Success
+ * @return      -ENODATA - No frame is ready yet
+ * @return      < 0 - Error
+ */
+int klsmpte2064_encapsulation_pack_pts(void *hdl, uint8_t *data, uint32_t len, uint32_t *usedLength, int64_t *pts);
+
+/**
+ * @brief	    Push based, low latency alternative to klsmpte2064_encapsulation_pack(). The callback
+ *              receives a container from the video push thread the moment each frame's video
+ *              fingerprint is computed, with every audio fingerprint published since the previous
+ *              container. Audio types or programs seen before but not yet pushed for the frame are
+ *              flagged KLSMPTE2064_CONTAINER_AUDIO_ABSENT, once pushed they're sent from the audio
+ *              push thread as a KLSMPTE2064_CONTAINER_LATE_AUDIO container with the frame number it
+ *              belongs to, audio for each type arriving in order. Audio more than 8 frames late is dropped.
+ *              Containers are sent from the first frame, without a video fingerprint until there's
+ *              enough history, see 5.2.3.1.
+ *              The callback is serialised, containers arrive in sequence counter order. It must not
+ *              push into or reconfigure the context. Don't mix with the pack calls, they share the
+ *              sequence counter.
+ *              Call while no other thread is pushing into the context.
+ * @param[in]	void * - A previously allocated content/handle
+ * @param[in]	void (*emit)(opaque, hdl, data, len, frame, flags) - NULL disables. frame counts video
+ *              containers from 0, flags are the KLSMPTE2064_CONTAINER_* the container carries.
+ * @param[in]	void * - opaque, passed to the callback
+ * @return      0 - Success
+ * @return      < 0 - Error
+ */
+int klsmpte2064_encapsulation_set_emit(void *hdl,
+	void (*emit)(void *opaque, void *hdl, const uint8_t *data, uint32_t len, uint64_t frame, uint32_t flags),
+	void *opaque);
+
 #ifdef __cplusplus
 };
 #endif
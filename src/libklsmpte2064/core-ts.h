@@ -0,0 +1,82 @@
+/**
+ * @file	core-ts.h
+ * @author	Steven Toth <stoth@kernellabs.com>
+ * @copyright	Copyright (c) 2025 Kernel Labs Inc. All Rights Reserved.
+ * @brief	Containers carried as ISO13818-1 PES in transport stream packets
+ */
+
+#ifndef _LIBKLSMPTE2064_CORE_TS_H
+#define _LIBKLSMPTE2064_CORE_TS_H
+
+#include <stdint.h>
+#include <stdarg.h>
+#include <sys/errno.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define KLSMPTE2064_TS_PACKET_SIZE 188
+
+/**
+ * @brief	Parameters for klsmpte2064_ts_alloc(). Zero for the defaults, except the pid.
+ */
+struct klsmpte2064_ts_params_s
+{
+	uint16_t pid;      /**< Transport PID the containers are carried on, 0x20 - 0x1ffe. */
+	uint8_t streamId;  /**< PES stream_id. Default 0xbd, private_stream_1. Ids without the optional PES header (Eg. 0xbe, 0xbf) are rejected. */
+	const struct klsmpte2064_allocator_s *allocator; /**< NULL for malloc/free. Copied, needn't outlive the call. */
+};
+
+/**
+ * @brief	One container to packetise, Eg. from klsmpte2064_encapsulation_pack_pts().
+ */
+struct klsmpte2064_ts_frame_s
+{
+	const uint8_t *data; /**< Container */
+	uint32_t len;        /**< Container length in bytes */
+	int64_t pts;         /**< 90KHz, the PTS of the video frame the container describes. */
+	int64_t pcr;         /**< 27MHz, carried in the first packet when this PID is also the PCR PID. -1 for none. */
+};
+
+/**
+ * @brief	    Allocate a packetiser, tracking the continuity counter of a single PID.
+ * @param[out]	void ** - packetiser handle
+ * @param[in]	const struct klsmpte2064_ts_params_s * - params
+ * @return      0 - Success
+ * @return      < 0 - Error
+ */
+int klsmpte2064_ts_alloc(void **hdl, const struct klsmpte2064_ts_params_s *params);
+
+/**
+ * @brief	    Wrap containers into PES packets (PTS only, data aligned) and those into transport packets,
+ *              written directly into a caller supplied run of 188 byte packets. Each PES starts a new
+ *              packet and its last packet is padded with adaptation field stuffing, so no packet mixes
+ *              frames and a PCR is only ever placed at the head of a PES, where a remultiplexer expects it.
+ *              Whole frames are packetised in order until the frames or the packets run out.
+ *              The batch is validated first, on error nothing is written.
+ * @param[in]	void * - A previously allocated packetiser
+ * @param[in]	const struct klsmpte2064_ts_frame_s * - frames, oldest first
+ * @param[in]	uint32_t - number of frames
+ * @param[out]	uint8_t * - packets, packetCount * KLSMPTE2064_TS_PACKET_SIZE bytes
+ * @param[in]	uint32_t - number of packets available
+ * @param[out]	uint32_t * - number of frames packetised (optional)
+ * @return      >= 0 - Number of packets written
+ * @return      -ENOSPC - Not even the first frame fits
+ * @return      -EINVAL - A frame has no data, is too long or has a negative PTS
+ * @return      < 0 - Error
+ */
+int klsmpte2064_ts_packetise(void *hdl, const struct klsmpte2064_ts_frame_s *frames, uint32_t frameCount,
+	uint8_t *packets, uint32_t packetCount, uint32_t *framesUsed);
+
+/**
+ * @brief	    Free a previously allocated packetiser.
+ * @param[in]	void * - A previously allocated packetiser
+ */
+void klsmpte2064_ts_free(void *hdl);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* _LIBKLSMPTE2064_CORE_TS_H */
@@ -20,6 +20,8 @@ extern "C" {
  * @brief	    Push a video frame into the solution for processing.
  *              During context creation the width, height, depth etc was declared,
  *              pay attension and don't violate that.
+ *              May be called concurrently with the audio push and pack calls from other threads,
+ *              but only one thread may push video into a context at a time.
  * @param[in]	void * - A previously allocated content/handle
  * @param[in]	const uint8_t * - The luma plane.
  * @return      0 - Success
@@ -27,6 +29,165 @@ extern "C" {
  */
 int klsmpte2064_video_push(void *hdl, const uint8_t *lumaplane);
 
+/**
+ * @brief	    Push one video frame into each of several contexts, Eg. every channel on a host
+ *              once per frame period. Equivalent to klsmpte2064_video_push() per context.
+ * @param[in]	void *[] - Array of previously allocated contexts/handles
+ * @param[in]	const uint8_t *[] - The luma plane for each context.
+ * @param[in]	uint32_t count - Number of contexts.
+ * @param[out]	int [] - Result of each push (optional).
+ * @return      0 - Success
+ * @return      < 0 - The first error, see results for which contexts failed.
+ */
+int klsmpte2064_video_push_batch(void *hdls[], const uint8_t *lumaplanes[], uint32_t count, int results[]);
+
+/**
+ * @brief	    Push a timestamped video frame into the solution for processing.
+ *              The resulting fingerprint is held in the contexts alignment buffer until
+ *              audio for the same PTS arrives, see klsmpte2064_encapsulation_pack_pts().
+ *              May be called from a different thread to klsmpte2064_audio_push_pts().
+ * @param[in]	void * - A previously allocated content/handle
+ * @param[in]	const uint8_t * - The luma plane.
+ *              Once the frame duration is known, a PTS that jumps forward by more than
+ *              one and a half frames, or moves backwards, signals a discontinuity,
+ *              see klsmpte2064_video_signal_discontinuity().
+ * @param[in]	int64_t pts - Presentation timestamp of the frame, 90KHz clock.
+ * @return      0 - Success
+ * @return      < 0 - Error
+ */
+int klsmpte2064_video_push_pts(void *hdl, const uint8_t *lumaplane, int64_t pts);
+
+/**
+ * @brief	    Signal that one or more frames were lost before the next video push,
+ *              Eg. the capture card dropped frames or the source switched.
+ *              The motion history is reseeded from the next frame pushed rather than compared
+ *              with content from before the gap. That frame's container carries no video
+ *              fingerprint and is marked KLSMPTE2064_CONTAINER_DISCONTINUITY, for progressive
+ *              video the following container is marked KLSMPTE2064_CONTAINER_RESYNC.
+ *              klsmpte2064_video_push_pts() also infers discontinuities from PTS gaps.
+ *              May be called from any thread.
+ * @param[in]	void * - A previously allocated content/handle
+ * @return      0 - Success
+ * @return      < 0 - Error
+ */
+int klsmpte2064_video_signal_discontinuity(void *hdl);
+
+enum klsmpte2064_motion_compare_e
+{
+    MOTION_COMPARE_GREATER_THAN = 0, /**< Pixel changed if diff > threshold. Library default. */
+    MOTION_COMPARE_GREATER_EQUAL,    /**< Pixel changed if diff >= threshold, as worded in 5.2.3.2. */
+};
+
+/**
+ * @brief	    Adjust the per pixel motion threshold used during 5.2.3.2 pixel counting.
+ *              The default is a threshold of 32 with MOTION_COMPARE_GREATER_THAN.
+ *              Can be called at any time, takes effect on the next video push.
+ * @param[in]	void * - A previously allocated content/handle
+ * @param[in]	uint32_t threshold - 0 to 255, compared against the 8 bit absolute pixel difference.
+ * @param[in]	enum klsmpte2064_motion_compare_e - Eg. MOTION_COMPARE_GREATER_EQUAL
+ * @return      0 - Success
+ * @return      < 0 - Error
+ */
+int klsmpte2064_video_set_motion_threshold(void *hdl, uint32_t threshold, enum klsmpte2064_motion_compare_e compare);
+
+/* Grid capture stream, see klsmpte2064_video_set_grid_capture() */
+#define KLSMPTE2064_GRID_HEADER_SIZE 16 /**< Stream header, delivered once when capture is enabled. */
+#define KLSMPTE2064_GRID_RECORD_SIZE(fields) (2 + ((fields) * 960)) /**< One frame, 1 field progressive, 2 interlaced. */
+
+/**
+ * @brief	    Record the 16x60 windowed grid (5.2.2) of every frame pushed, everything the video
+ *              fingerprint depends on, 962 bytes per progressive frame. The stream header is passed
+ *              to sink before this call returns, then one record per frame from the video push
+ *              thread. Stored to disk back to back, they form a stream klsmpte2064_video_replay_grid()
+ *              can recompute motion, fingerprints and analytics from without the source video.
+ * @param[in]	void * - A previously allocated content/handle
+ * @param[in]	void (*sink)(void *opaque, const uint8_t *data, uint32_t len) - Receives the stream, NULL to stop.
+ * @param[in]	void *opaque - Passed to sink.
+ * @return      0 - Success
+ * @return      < 0 - Error
+ */
+int klsmpte2064_video_set_grid_capture(void *hdl, void (*sink)(void *opaque, const uint8_t *data, uint32_t len), void *opaque);
+
+/**
+ * @brief	    Consume the next header or frame record of a grid capture stream. A frame record is
+ *              processed exactly as the frame was when pushed, with the contexts current motion
+ *              threshold, Eg. replay an archive with another threshold then pack the containers.
+ *              The context must have the same progressive setting as the captured one, its
+ *              resolution and colorspace are not used. Call from the video push thread.
+ * @param[in]	void * - A previously allocated content/handle
+ * @param[in]	const uint8_t * - The stream, positioned at a header or a record.
+ * @param[in]	uint32_t len - Bytes available.
+ * @param[out]	uint32_t * - Bytes consumed.
+ * @return      1 - A frame was replayed.
+ * @return      0 - A header was consumed.
+ * @return      -EAGAIN - len is short of the next header or record.
+ * @return      -EBADMSG - Not a grid stream, or an unsupported version.
+ * @return      -EINVAL - The stream doesn't match the contexts scan type.
+ */
+int klsmpte2064_video_replay_grid(void *hdl, const uint8_t *data, uint32_t len, uint32_t *usedLength);
+
+/* Video analytics flags, see klsmpte2064_video_analytics_s */
+#define KLSMPTE2064_VIDEO_ANALYTICS_FROZEN    (1 << 0) /**< The frame repeats the previous one. */
+#define KLSMPTE2064_VIDEO_ANALYTICS_BLACK     (1 << 1) /**< The frame is black. */
+#define KLSMPTE2064_VIDEO_ANALYTICS_SCENE_CUT (1 << 2) /**< The frame starts a new scene. */
+
+/**
+ * @brief	Per frame picture metrics, measured on the 960 windowed samples of 5.2.2
+ *          the fingerprint is computed from, so they cost no extra read of the frame.
+ *          For interlaced video the samples are those of the second field.
+ */
+struct klsmpte2064_video_analytics_s
+{
+    uint64_t frame;          /**< Frames analysed since analytics were enabled, 1 based. */
+    double meanLuma;         /**< Mean of the windowed samples, 8 bit, 0 .. 255. */
+    double variance;         /**< Variance of the windowed samples. */
+    double motion;           /**< Fraction of samples counted as changed by 5.2.3.2, 0 .. 1. */
+    double difference;       /**< Mean absolute difference from the previous frame, 8 bit. */
+    uint32_t freezeFrames;   /**< Consecutive frozen frames up to and including this one, 0 if moving. */
+    uint32_t blackFrames;    /**< Consecutive black frames up to and including this one, 0 if not black. */
+    uint32_t flags;          /**< KLSMPTE2064_VIDEO_ANALYTICS_ flags of this frame. */
+};
+
+/**
+ * @brief	Thresholds and notification for klsmpte2064_video_analytics_enable(). Zero for the defaults.
+ */
+struct klsmpte2064_video_analytics_params_s
+{
+    double freezeDifference;   /**< Frozen at or below this mean absolute difference. Default 0.5 */
+    uint32_t blackLevel;       /**< A sample at or below this 8 bit level is black. Default 32 */
+    double blackRatio;         /**< Black when at least this fraction of samples are black. Default 0.98 */
+    double sceneCutDifference; /**< A scene cut when the mean absolute difference rises to this. Default 30 */
+
+    /** Optional, called from the video push thread when a frame freezes or unfreezes,
+     *  goes to or from black, or cuts. changed holds the KLSMPTE2064_VIDEO_ANALYTICS_ flags
+     *  that changed, a scene cut is always reported as changed.
+     */
+    void (*stateChange)(void *opaque, void *hdl, const struct klsmpte2064_video_analytics_s *stats, uint32_t changed);
+    void *opaque;              /**< Passed to stateChange. */
+};
+
+/**
+ * @brief	    Enable or disable per frame video analytics, disabled by default.
+ *              Freeze and scene cut detection compare against the previous frame, neither is
+ *              reported for the first frame or the frame after a discontinuity.
+ *              Call from the video push thread, or before pushing. Resets the runs.
+ * @param[in]	void * - A previously allocated content/handle
+ * @param[in]	const struct klsmpte2064_video_analytics_params_s * - Thresholds, copied. NULL to disable.
+ * @return      0 - Success
+ * @return      < 0 - Error
+ */
+int klsmpte2064_video_analytics_enable(void *hdl, const struct klsmpte2064_video_analytics_params_s *params);
+
+/**
+ * @brief	    Fetch the analytics of the most recently pushed frame. May be called from any thread.
+ * @param[in]	void * - A previously allocated content/handle
+ * @param[out]	struct klsmpte2064_video_analytics_s * - The metrics.
+ * @return      0 - Success
+ * @return      -EAGAIN - Analytics are disabled or no frame has been analysed yet.
+ * @return      < 0 - Error
+ */
+int klsmpte2064_video_analytics_query(void *hdl, struct klsmpte2064_video_analytics_s *stats);
+
 #ifdef __cplusplus
 };
 #endif
@@ -63,6 +63,7 @@
 #define _LIBKLSMPTE2064_CORE_H
 
 #include <stdint.h>
+#include <stddef.h>
 #include <stdarg.h>
 #include <sys/errno.h>
 
@@ -75,22 +76,105 @@ enum klsmpte2064_colorspace_e
 	COLORSPACE_UNDEFINED = 0,
 	COLORSPACE_YUV420P,       /**< Most commonly used with 8 bit codecs. */
 	COLORSPACE_V210,          /**< Most commonly used with Decklink SDI cards. */
+	COLORSPACE_NV12,          /**< 8 bit luma plane followed by interleaved chroma, pass the luma plane. */
+	COLORSPACE_UYVY,          /**< 8 bit packed 4:2:2, U0 Y0 V0 Y1. Stride is in bytes (2 * width minimum). */
+	COLORSPACE_P010,          /**< 16 bit little endian luma plane, 10 bits MSB aligned. Stride is in bytes. */
+	COLORSPACE_YUV420P10LE,   /**< 16 bit little endian luma plane, 10 bits LSB aligned. Stride is in bytes. */
+	COLORSPACE_YUV420P16LE,   /**< 16 bit little endian luma plane. Stride is in bytes. */
 	COLORSPACE_MAX,
 };
 
+/**
+ * @brief	Video frame rates. The values are the SMPTE ST 253 Picture_Rate codes written into each container.
+ */
+enum klsmpte2064_frame_rate_e
+{
+	FRAMERATE_UNDEFINED = 0, /**< Audio cadence learned from the first audio push, containers report 59.94. */
+	FRAMERATE_23_976,        /**< 24000/1001 */
+	FRAMERATE_24,
+	FRAMERATE_25,
+	FRAMERATE_29_97,         /**< 30000/1001 */
+	FRAMERATE_30,
+	FRAMERATE_50,
+	FRAMERATE_59_94,         /**< 60000/1001 */
+	FRAMERATE_60,
+	FRAMERATE_MAX,
+};
+
+/**
+ * @brief	Caller supplied memory allocator, Eg. an arena or pool. Every allocation the
+ *          library makes for a context or scratch goes through these callbacks.
+ */
+struct klsmpte2064_allocator_s
+{
+	void *(*alloc)(void *opaque, size_t size); /**< Return NULL on failure. Need not zero or align the memory. */
+	void (*free)(void *opaque, void *ptr);     /**< Release a pointer returned by alloc. */
+	void *opaque;                              /**< Passed to both callbacks. */
+};
+
+/* Luma frame placement flags, see klsmpte2064_scratch_set_placement() */
+#define KLSMPTE2064_PLACEMENT_HUGEPAGES (1 << 0) /**< Back the luma frames with 2MB huge pages. MAP_HUGETLB, else transparent huge pages. */
+#define KLSMPTE2064_PLACEMENT_NUMA      (1 << 1) /**< Bind the luma frames to a NUMA node. */
+
+/**
+ * @brief	Optional parameters for klsmpte2064_context_alloc_ex(). Zero for the defaults.
+ */
+struct klsmpte2064_context_params_s
+{
+	const struct klsmpte2064_allocator_s *allocator; /**< NULL for malloc/free. Copied, needn't outlive the call. */
+	void *videoScratch; /**< From klsmpte2064_scratch_alloc(), NULL for a private scratch. */
+	void *audioScratch; /**< From klsmpte2064_scratch_alloc(), NULL for a private scratch. */
+	uint32_t placement; /**< KLSMPTE2064_PLACEMENT_ flags for a private video scratch. */
+	int numaNode;       /**< With KLSMPTE2064_PLACEMENT_NUMA, Eg. the node the capture card is attached to. */
+	enum klsmpte2064_frame_rate_e frameRate; /**< Selects Table 3, the audio cadence and the containers Picture_Rate. */
+};
+
+/**
+ * @brief	Cost governor levels, see klsmpte2064_governor_enable(). Each level sheds more work than the last.
+ */
+enum klsmpte2064_governor_level_e
+{
+	GOVERNOR_LEVEL_FULL = 0,  /**< As configured, the spec full frame prefilter. */
+	GOVERNOR_LEVEL_WINDOWED,  /**< Only the lines and columns the 5.2.2 window reads are prefiltered. Fingerprints are unchanged. */
+	GOVERNOR_LEVEL_ESSENTIAL, /**< Windowed, video analytics and console debug suspended. Fingerprints only. */
+	GOVERNOR_LEVEL_MAX,
+};
+
+/**
+ * @brief	Parameters for klsmpte2064_governor_enable(). Zero selects the defaults.
+ */
+struct klsmpte2064_governor_params_s
+{
+	uint32_t budgetUs;  /**< Time the video and audio pushes may spend per frame, Eg. 2000. Required. */
+	double highWater;   /**< Fraction of the budget above which a level is shed. Default 0.9 */
+	double lowWater;    /**< Fraction of the budget below which a level is restored. Default 0.5 */
+	uint32_t window;    /**< Frames averaged per decision. Default 30 */
+
+	/** Called from the video push thread whenever the level changes.
+	 *  averageUs is the per frame cost of the window that triggered it.
+	 */
+	void (*levelChange)(void *opaque, void *hdl, enum klsmpte2064_governor_level_e level,
+		enum klsmpte2064_governor_level_e previous, uint32_t averageUs);
+	void *opaque;       /**< Passed to levelChange. */
+};
+
 /**
  * @brief	    Allocate a unique handle for the framework, for use with further calls.
- *              The library supports all of the colorspace formats listed in the enum, a 8 or 10 bit depth
+ *              The library supports all of the colorspace formats listed in the enum, a 8, 10 or 16 bit depth
  *              packing. Most 8 bit codec typically take YUV420P, 8 bit. If you want higher levels of depth
- *              use V210.
+ *              use V210, P010 or the 10/16 bit planar formats.
  * @param[out]	void ** - handle
  * @param[in]	enum klsmpte2064_colorspace_e - Typically COLORSPACE_YUV420P
- * @param[in]	uint32_t progressive - Boolean. Is the video progressive?
+ * @param[in]	uint32_t progressive - Boolean. Is the video progressive? Interlaced frames are
+ *              pushed as a single interleaved frame, field 1 on the even lines. Each field
+ *              gets its own video fingerprint.
  * @param[in]	uint32_t width - in pixels
  * @param[in]	uint32_t height - in pixels
  * @param[in]	uint32_t stride - Size of each line of video in bytes
- * @param[in]	uint32_t bitdepth - either 8 or 10 only. COLORSPACE_YUV420P is 8, V210 is 10.
+ * @param[in]	uint32_t bitdepth - 8, 10 or 16. COLORSPACE_YUV420P, NV12 and UYVY are 8, V210, P010 and
+ *              YUV420P10LE are 10, YUV420P16LE is 16. Only the 8 most significant bits are used (5.2).
  * @return      0 - Success
+ * @return      -ENOMEM - Allocation failed
  * @return      < 0 - Error
  */
 int klsmpte2064_context_alloc(void **hdl,
@@ -102,6 +186,81 @@ int klsmpte2064_context_alloc(void **hdl,
 	uint32_t bitdepth);
 
 
+/**
+ * @brief	    Same as klsmpte2064_context_alloc(), with an allocation policy.
+ *              Contexts and their working buffers are always cache line aligned, whatever
+ *              the allocator returns, so contexts pushed from different cores never share a line.
+ *              By default each context owns its luma frames and audio working buffers. None of
+ *              that memory holds state between push calls, so a worker thread servicing many
+ *              contexts can share one scratch between them, reducing memory for hundreds of
+ *              contexts to roughly one frame per worker. A scratch must only be used by one
+ *              thread at a time, pass separate video and audio scratches when video and audio
+ *              for a context are pushed from different threads.
+ * @param[out]	void ** - handle
+ * @param[in]	enum klsmpte2064_colorspace_e - See klsmpte2064_context_alloc()
+ * @param[in]	uint32_t progressive - See klsmpte2064_context_alloc()
+ * @param[in]	uint32_t width - in pixels
+ * @param[in]	uint32_t height - in pixels
+ * @param[in]	uint32_t stride - Size of each line of video in bytes
+ * @param[in]	uint32_t bitdepth - See klsmpte2064_context_alloc()
+ * @param[in]	const struct klsmpte2064_context_params_s * - Allocation policy, or NULL for the defaults.
+ * @return      0 - Success
+ * @return      -ENOMEM - Allocation failed
+ * @return      < 0 - Error
+ */
+int klsmpte2064_context_alloc_ex(void **hdl,
+	enum klsmpte2064_colorspace_e colorspace,
+	uint32_t progressive,
+	uint32_t width,
+	uint32_t height,
+	uint32_t stride,
+	uint32_t bitdepth,
+	const struct klsmpte2064_context_params_s *params);
+
+/**
+ * @brief	    Allocate a scratch area to share between contexts, see klsmpte2064_context_alloc_ex().
+ *              It grows to fit the largest context using it, allocating contexts up front means
+ *              the push calls never allocate.
+ * @param[out]	void ** - scratch
+ * @param[in]	const struct klsmpte2064_allocator_s * - NULL for malloc/free.
+ * @return      0 - Success
+ * @return      < 0 - Error
+ */
+int klsmpte2064_scratch_alloc(void **scratch, const struct klsmpte2064_allocator_s *allocator);
+
+/**
+ * @brief	    Control where the scratch places its luma frames (the full frame prefilter output and
+ *              the V210 conversion), 8MB each at 4K and streamed every frame. Huge pages cut TLB misses,
+ *              binding to the node of the capture card avoids cross socket traffic.
+ *              Placed frames are mapped directly from the kernel, not through the allocator.
+ *              Huge pages fall back to transparent huge pages when none are reserved.
+ *              Call before any context using the scratch is allocated. Linux only.
+ * @param[in]	void * - A previously allocated scratch
+ * @param[in]	uint32_t flags - 0 or KLSMPTE2064_PLACEMENT_ flags
+ * @param[in]	int numaNode - Node for KLSMPTE2064_PLACEMENT_NUMA, otherwise ignored.
+ * @return      0 - Success
+ * @return      -EBUSY - Frames have already been allocated
+ * @return      -EOPNOTSUPP - Not supported on this platform
+ * @return      < 0 - Error
+ */
+int klsmpte2064_scratch_set_placement(void *scratch, uint32_t flags, int numaNode);
+
+/**
+ * @brief	    Pin the calling thread to the CPUs of a NUMA node and prefer that node for its memory.
+ *              A convenience for the threads pushing into contexts placed with KLSMPTE2064_PLACEMENT_NUMA.
+ *              Linux only.
+ * @param[in]	int numaNode - Eg. 1
+ * @return      0 - Success
+ * @return      < 0 - Error
+ */
+int klsmpte2064_thread_set_numa_node(int numaNode);
+
+/**
+ * @brief	    Free a scratch area, after every context using it has been freed.
+ * @param[in]	void * - A previously allocated scratch
+ */
+void klsmpte2064_scratch_free(void *scratch);
+
 /**
  * @brief	    Raise (1) or lower (0) the overal level of console debug from the library.
  *              The default is zero, no console output under normal operating conditions.
@@ -112,6 +271,68 @@ int klsmpte2064_context_alloc(void **hdl,
  */
 int klsmpte2064_context_set_verbose(void *hdl, int level);
 
+/**
+ * @brief	    Enable the cost governor. The time spent in the video and audio push calls is measured
+ *              against a per frame budget. When a window of frames averages above the high water mark
+ *              the context sheds one level of optional work, see enum klsmpte2064_governor_level_e,
+ *              when it averages below the low water mark it restores one. A restore that
+ *              immediately overruns again doubles the wait before the next attempt.
+ *              Decisions are taken on the video push thread. The library runs no threads of its own,
+ *              shedding is limited to work done inside the pushes.
+ *              Call while no other thread is pushing into the context.
+ * @param[in]	void * - A previously allocated content/handle
+ * @param[in]	const struct klsmpte2064_governor_params_s * - Copied. NULL disables, restoring the full level.
+ * @return      0 - Success
+ * @return      < 0 - Error
+ */
+int klsmpte2064_governor_enable(void *hdl, const struct klsmpte2064_governor_params_s *params);
+
+/**
+ * @brief	    Query the current governor level and the per frame cost of the last completed window.
+ * @param[in]	void * - A previously allocated content/handle
+ * @param[out]	enum klsmpte2064_governor_level_e * - level
+ * @param[out]	uint32_t * - averageUs, or NULL
+ * @return      0 - Success
+ * @return      < 0 - Error
+ */
+int klsmpte2064_governor_query(void *hdl, enum klsmpte2064_governor_level_e *level, uint32_t *averageUs);
+
+/**
+ * @brief	    Serialise the state a context carries from one frame to the next: the video motion
+ *              history, the container sequence counter, partially streamed audio, the audio
+ *              decimators, the learned frame cadence and the freeze, black and silence runs. A standby process restores it with
+ *              klsmpte2064_context_state_restore() and resumes mid-stream, with continuous
+ *              sequence numbers and no frames of history to rebuild.
+ *              The format is portable between hosts, a few KB in size.
+ *              Configuration (motion threshold, audio programs, etc) isn't included.
+ *              Call while no other thread is pushing into the context.
+ * @param[in]	void * - A previously allocated content/handle
+ * @param[in]   uint8_t * - user supplied buffer, or NULL to query the size
+ * @param[in]   uint32_t - buffer length in bytes
+ * @param[out]  uint32_t * - number of buffer bytes used, or needed
+ * @return      0 - Success
+ * @return      -ENOSPC - Buffer too small, usedLength holds the size needed
+ * @return      < 0 - Error
+ */
+int klsmpte2064_context_state_save(void *hdl, uint8_t *data, uint32_t len, uint32_t *usedLength);
+
+/**
+ * @brief	    Restore state saved by klsmpte2064_context_state_save() into a context allocated
+ *              and configured the same way (colorspace, size, scan, sample rate, audio programs).
+ *              The context is left untouched on error. On success the restored fingerprints are
+ *              published at once, klsmpte2064_encapsulation_pack() needn't wait for the next push,
+ *              and a callback set by klsmpte2064_encapsulation_set_emit() receives that container.
+ *              Call while no other thread is pushing into the context.
+ * @param[in]	void * - A previously allocated content/handle
+ * @param[in]   const uint8_t * - saved state
+ * @param[in]   uint32_t - length in bytes
+ * @return      0 - Success
+ * @return      -EBADMSG - Not a saved state, or truncated
+ * @return      -EINVAL - Saved from a context configured differently
+ * @return      < 0 - Error
+ */
+int klsmpte2064_context_state_restore(void *hdl, const uint8_t *data, uint32_t len);
+
 /**
  * @brief	    Free a previously allocated handle.
  * @param[in]	void * - A previously allocated content/handle
@@ -12,6 +12,8 @@
 #include <libklsmpte2064/core-audio.h>
 #include <libklsmpte2064/core-video.h>
 #include <libklsmpte2064/core-encapsulation.h>
+#include <libklsmpte2064/core-ts.h>
+#include <libklsmpte2064/core-anc.h>
 #include <libklsmpte2064/core-csc.h>
 
 #endif /* _LIBKLSMPTE2064_H */
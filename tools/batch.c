@@ -0,0 +1,278 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include <libklsmpte2064/klsmpte2064.h>
+
+/* Batched pushes against single pushes, over the same synthetic frames.
+ *
+ * Two sets of contexts receive identical video and audio. One set is fed with
+ * klsmpte2064_video_push_batch() and klsmpte2064_audio_push_batch(), the other
+ * with klsmpte2064_video_push() and klsmpte2064_audio_push() one context at a
+ * time. Every frame period the containers of each pair are packed and
+ * compared, any difference fails the run. The audio pushes are timed per
+ * frame period, for all contexts, each way.
+ */
+
+#define AUDIO_RATE 48000
+#define FRAME_RATE_NUM 60000
+#define FRAME_RATE_DEN 1001
+#define VIDEO_HISTORY  3 /* Frames before video fingerprints are valid, 5.2.3.1 */
+
+struct tool_ctx_s
+{
+	int verbose;
+	uint32_t width;
+	uint32_t height;
+	uint32_t frames;
+	uint32_t contexts;
+	int pipeline;
+	int video; /* Push video every frame, else only until the fingerprints are valid */
+
+	void **single;
+	void **batch;
+
+	uint8_t **luma;      /* Per context, regenerated each frame */
+	int16_t **audio;     /* Per context, left and right planes of one frame */
+	uint32_t samples;
+};
+
+static uint64_t clock_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+/* A different enveloped tone, and a moving gradient, per context */
+static void synthesise(struct tool_ctx_s *tool, uint32_t frame)
+{
+	for (uint32_t c = 0; c < tool->contexts; c++) {
+		int16_t *l = tool->audio[c];
+		int16_t *r = l + tool->samples;
+		for (uint32_t i = 0; i < tool->samples; i++) {
+			double t = (double)((frame * tool->samples) + i) / AUDIO_RATE;
+			double env = 0.5 + (0.5 * sin(2 * M_PI * (2 + (c % 7)) * t));
+			l[i] = (int16_t)(20000 * env * sin(2 * M_PI * (220 + (c * 40)) * t)) + ((rand() % 2000) - 1000);
+			r[i] = l[i] / 2;
+		}
+
+		if (!tool->video && frame >= VIDEO_HISTORY) {
+			continue;
+		}
+		uint8_t *y = tool->luma[c];
+		for (uint32_t row = 0; row < tool->height; row++) {
+			uint8_t v = (uint8_t)((row / 8) + (frame * (1 + (c % 3))) + (c * 16));
+			memset(y + (row * tool->width), v, tool->width);
+		}
+	}
+}
+
+static int alloc_contexts(struct tool_ctx_s *tool, void **hdls)
+{
+	for (uint32_t i = 0; i < tool->contexts; i++) {
+		if (klsmpte2064_context_alloc(&hdls[i], COLORSPACE_YUV420P, 1, tool->width, tool->height, tool->width, 8) < 0) {
+			return -1;
+		}
+		if (klsmpte2064_audio_set_pipeline(hdls[i], tool->pipeline) < 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void usage(const char *program)
+{
+	printf("Version: %s\n", GIT_VERSION);
+	printf("Check batched video and audio pushes produce the containers of single pushes, and time them.\n");
+	printf("Usage: %s\n", program);
+	printf("  -c number of contexts (def: 32)\n");
+	printf("  -n number of frames (def: 400)\n");
+	printf("  -p audio pipeline, 0 float, 1 fixed, 2 fixed spec (def: 0)\n");
+	printf("  -H pixel height (def: 720)\n");
+	printf("  -W pixel width (def: 1280)\n");
+	printf("  -A audio only, video is pushed for the first %d frames only\n", VIDEO_HISTORY);
+	printf("  -v increase level of verbosity\n");
+	printf("\n");
+	printf("  Eg. %s -c 32 -n 400\n\n", program);
+}
+
+int main(int argc, char *argv[])
+{
+	struct tool_ctx_s tool = { 0 };
+	tool.width = 1280;
+	tool.height = 720;
+	tool.frames = 400;
+	tool.contexts = 32;
+	tool.video = 1;
+
+	int ch;
+
+	while ((ch = getopt(argc, argv, "?hc:n:p:vAH:W:")) != -1) {
+		switch (ch) {
+		case 'c':
+			tool.contexts = atoi(optarg);
+			break;
+		case 'n':
+			tool.frames = atoi(optarg);
+			break;
+		case 'p':
+			tool.pipeline = atoi(optarg);
+			break;
+		case 'A':
+			tool.video = 0;
+			break;
+		case 'H':
+			tool.height = atoi(optarg);
+			break;
+		case 'W':
+			tool.width = atoi(optarg);
+			break;
+		case 'v':
+			tool.verbose++;
+			break;
+		case '?':
+		case 'h':
+		default:
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	if (tool.contexts == 0 || tool.frames == 0 || tool.width == 0 || tool.height == 0) {
+		usage(argv[0]);
+		exit(1);
+	}
+
+	tool.samples = (AUDIO_RATE * FRAME_RATE_DEN) / FRAME_RATE_NUM;
+	tool.single = calloc(tool.contexts, sizeof(void *));
+	tool.batch = calloc(tool.contexts, sizeof(void *));
+	tool.luma = calloc(tool.contexts, sizeof(uint8_t *));
+	tool.audio = calloc(tool.contexts, sizeof(int16_t *));
+	const uint8_t **lumaplanes = calloc(tool.contexts, sizeof(uint8_t *));
+	const int16_t ***planes = calloc(tool.contexts, sizeof(int16_t **));
+	const int16_t **planePairs = calloc(tool.contexts * 2, sizeof(int16_t *));
+	uint32_t *sampleCounts = calloc(tool.contexts, sizeof(uint32_t));
+	int *results = calloc(tool.contexts, sizeof(int));
+	if (!tool.single || !tool.batch || !tool.luma || !tool.audio || !lumaplanes || !planes ||
+		!planePairs || !sampleCounts || !results) {
+		fprintf(stderr, "Unable to allocate\n");
+		return -1;
+	}
+
+	for (uint32_t c = 0; c < tool.contexts; c++) {
+		tool.audio[c] = malloc(sizeof(int16_t) * tool.samples * 2);
+		if (!tool.audio[c]) {
+			return -1;
+		}
+		tool.luma[c] = malloc((size_t)tool.width * tool.height);
+		if (!tool.luma[c]) {
+			return -1;
+		}
+		lumaplanes[c] = tool.luma[c];
+		planePairs[(c * 2) + 0] = tool.audio[c];
+		planePairs[(c * 2) + 1] = tool.audio[c] + tool.samples;
+		planes[c] = &planePairs[c * 2];
+		sampleCounts[c] = tool.samples;
+	}
+
+	if (alloc_contexts(&tool, tool.single) < 0 || alloc_contexts(&tool, tool.batch) < 0) {
+		fprintf(stderr, "Unable to allocate a context\n");
+		return -1;
+	}
+
+	srand(7);
+
+	uint64_t singleNs = 0, batchNs = 0;
+	uint32_t containers = 0, identical = 0;
+	int ret = 0;
+
+	for (uint32_t f = 0; f < tool.frames && ret == 0; f++) {
+		synthesise(&tool, f);
+
+		if (tool.video || f < VIDEO_HISTORY) {
+			for (uint32_t c = 0; c < tool.contexts; c++) {
+				if (klsmpte2064_video_push(tool.single[c], lumaplanes[c]) < 0) {
+					ret = -1;
+				}
+			}
+			if (klsmpte2064_video_push_batch(tool.batch, lumaplanes, tool.contexts, results) < 0) {
+				ret = -1;
+			}
+		}
+
+		uint64_t start = clock_ns();
+		for (uint32_t c = 0; c < tool.contexts; c++) {
+			if (klsmpte2064_audio_push(tool.single[c], AUDIOTYPE_STEREO_S16P, FRAME_RATE_DEN, FRAME_RATE_NUM,
+				planes[c], 2, tool.samples) < 0) {
+				ret = -1;
+			}
+		}
+		uint64_t mid = clock_ns();
+		if (klsmpte2064_audio_push_batch(tool.batch, AUDIOTYPE_STEREO_S16P, FRAME_RATE_DEN, FRAME_RATE_NUM,
+			planes, 2, sampleCounts, tool.contexts, results) < 0) {
+			ret = -1;
+		}
+		uint64_t end = clock_ns();
+		singleNs += mid - start;
+		batchNs += end - mid;
+
+		if (ret < 0) {
+			fprintf(stderr, "Push failed at frame %u\n", f);
+			break;
+		}
+
+		for (uint32_t c = 0; c < tool.contexts; c++) {
+			uint8_t a[256], b[256];
+			uint32_t alen = 0, blen = 0;
+			int ra = klsmpte2064_encapsulation_pack(tool.single[c], a, sizeof(a), &alen);
+			int rb = klsmpte2064_encapsulation_pack(tool.batch[c], b, sizeof(b), &blen);
+			if (ra != rb) {
+				printf("frame %u context %u: pack returned %d single, %d batch\n", f, c, ra, rb);
+				ret = -1;
+				continue;
+			}
+			if (ra < 0) {
+				continue;
+			}
+			containers++;
+			if (alen == blen && memcmp(a, b, alen) == 0) {
+				identical++;
+			} else {
+				printf("frame %u context %u: containers differ\n", f, c);
+				ret = -1;
+			}
+		}
+	}
+
+	printf("%u contexts, %u frames, audio pipeline %d%s\n", tool.contexts, tool.frames, tool.pipeline,
+		tool.video ? "" : ", audio only");
+	printf("containers identical: %u of %u\n", identical, containers);
+	printf("audio push per frame period: single %" PRIu64 "us, batch %" PRIu64 "us\n",
+		singleNs / tool.frames / 1000, batchNs / tool.frames / 1000);
+
+	for (uint32_t c = 0; c < tool.contexts; c++) {
+		klsmpte2064_context_free(tool.single[c]);
+		klsmpte2064_context_free(tool.batch[c]);
+		free(tool.luma[c]);
+		free(tool.audio[c]);
+	}
+	free(tool.single);
+	free(tool.batch);
+	free(tool.luma);
+	free(tool.audio);
+	free(lumaplanes);
+	free(planes);
+	free(planePairs);
+	free(sampleCounts);
+	free(results);
+
+	return ret == 0 ? 0 : 1;
+}
@@ -0,0 +1,390 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include <libklsmpte2064/klsmpte2064.h>
+
+/* Cache traffic of concurrent audio and video pushes, read from the CPU's
+ * performance counters.
+ *
+ * Each context is driven twice over the same synthetic frames:
+ *  serial     - all pushes and packs on a single thread, on one cpu.
+ *  concurrent - per context, a video thread (pushing and packing) and an
+ *               audio thread, each pinned to a cpu of its own.
+ * The counters follow the threads, so the concurrent run minus the serial
+ * run is the traffic that comes from sharing lines across cores. Run it
+ * against builds before and after a layout change to compare them.
+ *
+ * Exits 0 with a note when counters or a second cpu aren't available,
+ * Eg. in containers or VMs with no PMU.
+ */
+
+#define AUDIO_RATE 48000
+#define FRAME_RATE_NUM 60000
+#define FRAME_RATE_DEN 1001
+
+struct counter_s
+{
+	const char *name;
+	uint32_t type;
+	uint64_t config;
+};
+
+static const struct counter_s counters[] = {
+	{ "cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	{ "L1d-misses",   PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+		(PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+};
+#define COUNTER_COUNT (sizeof(counters) / sizeof(counters[0]))
+
+struct tool_ctx_s
+{
+	int verbose;
+	uint32_t width;
+	uint32_t height;
+	uint32_t frames;
+	uint32_t contexts;
+	uint32_t cpus;
+
+	uint8_t *luma; /* frames * width * height */
+	int16_t *audio[2]; /* frames * samples per frame */
+	uint32_t samples;
+};
+
+struct thread_s
+{
+	struct tool_ctx_s *tool;
+	void *hdl;
+	int video; /* Push video, else audio */
+	int both; /* Serial, push both */
+	int cpu;
+	pthread_t thread;
+
+	int fds[COUNTER_COUNT];
+	uint64_t values[COUNTER_COUNT];
+	int result;
+};
+
+static int perf_open(const struct counter_s *c)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = c->type;
+	attr.config = c->config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	/* This thread only, on whichever cpu it runs */
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static int perf_begin(struct thread_s *t)
+{
+	for (uint32_t i = 0; i < COUNTER_COUNT; i++) {
+		t->fds[i] = perf_open(&counters[i]);
+		if (t->fds[i] < 0) {
+			int err = -errno;
+			while (i--) {
+				close(t->fds[i]);
+			}
+			return err;
+		}
+	}
+	for (uint32_t i = 0; i < COUNTER_COUNT; i++) {
+		ioctl(t->fds[i], PERF_EVENT_IOC_RESET, 0);
+		ioctl(t->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+
+	return 0;
+}
+
+static void perf_end(struct thread_s *t)
+{
+	for (uint32_t i = 0; i < COUNTER_COUNT; i++) {
+		ioctl(t->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+		if (read(t->fds[i], &t->values[i], sizeof(t->values[i])) != sizeof(t->values[i])) {
+			t->values[i] = 0;
+		}
+		close(t->fds[i]);
+	}
+}
+
+static void *thread_func(void *p)
+{
+	struct thread_s *t = (struct thread_s *)p;
+	struct tool_ctx_s *tool = t->tool;
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(t->cpu, &set);
+	sched_setaffinity(0, sizeof(set), &set);
+
+	t->result = perf_begin(t);
+	if (t->result < 0) {
+		return NULL;
+	}
+
+	uint8_t section[256];
+	uint32_t usedLength;
+	for (uint32_t i = 0; i < tool->frames; i++) {
+		if (t->video || t->both) {
+			if (klsmpte2064_video_push(t->hdl, tool->luma + ((size_t)i * tool->width * tool->height)) < 0) {
+				t->result = -EIO;
+				break;
+			}
+			klsmpte2064_encapsulation_pack(t->hdl, section, sizeof(section), &usedLength);
+		}
+		if (!t->video || t->both) {
+			const int16_t *planes[2] = {
+				tool->audio[0] + ((size_t)i * tool->samples),
+				tool->audio[1] + ((size_t)i * tool->samples),
+			};
+			if (klsmpte2064_audio_push(t->hdl, AUDIOTYPE_STEREO_S16P, FRAME_RATE_DEN, FRAME_RATE_NUM,
+				&planes[0], 2, tool->samples) < 0) {
+				t->result = -EIO;
+				break;
+			}
+		}
+	}
+
+	perf_end(t);
+
+	return NULL;
+}
+
+/* Run 'count' threads to completion, sum their counters into values[] */
+static int run(struct thread_s *threads, uint32_t count, uint64_t *values)
+{
+	for (uint32_t i = 0; i < count; i++) {
+		if (pthread_create(&threads[i].thread, NULL, thread_func, &threads[i]) != 0) {
+			return -ENOMEM;
+		}
+	}
+
+	int ret = 0;
+	memset(values, 0, COUNTER_COUNT * sizeof(*values));
+	for (uint32_t i = 0; i < count; i++) {
+		pthread_join(threads[i].thread, NULL);
+		if (threads[i].result < 0) {
+			ret = threads[i].result;
+		}
+		for (uint32_t k = 0; k < COUNTER_COUNT; k++) {
+			values[k] += threads[i].values[k];
+		}
+	}
+
+	return ret;
+}
+
+static int alloc_contexts(struct tool_ctx_s *tool, void **hdls)
+{
+	for (uint32_t i = 0; i < tool->contexts; i++) {
+		if (klsmpte2064_context_alloc(&hdls[i], COLORSPACE_YUV420P, 1, tool->width, tool->height, tool->width, 8) < 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void free_contexts(struct tool_ctx_s *tool, void **hdls)
+{
+	for (uint32_t i = 0; i < tool->contexts; i++) {
+		if (hdls[i]) {
+			klsmpte2064_context_free(hdls[i]);
+			hdls[i] = NULL;
+		}
+	}
+}
+
+/* Moving gradient video and a tone, so every frame does the full work */
+static int synthesise(struct tool_ctx_s *tool)
+{
+	size_t frameSize = (size_t)tool->width * tool->height;
+	tool->samples = (AUDIO_RATE * FRAME_RATE_DEN) / FRAME_RATE_NUM;
+
+	tool->luma = malloc(frameSize * tool->frames);
+	tool->audio[0] = malloc(sizeof(int16_t) * tool->samples * tool->frames);
+	tool->audio[1] = malloc(sizeof(int16_t) * tool->samples * tool->frames);
+	if (!tool->luma || !tool->audio[0] || !tool->audio[1]) {
+		return -1;
+	}
+
+	for (uint32_t f = 0; f < tool->frames; f++) {
+		uint8_t *y = tool->luma + (f * frameSize);
+		for (uint32_t r = 0; r < tool->height; r++) {
+			for (uint32_t c = 0; c < tool->width; c++) {
+				y[(r * tool->width) + c] = (uint8_t)((r + c + (f * 4)) ^ (c >> 3));
+			}
+		}
+	}
+	for (uint32_t s = 0; s < tool->samples * tool->frames; s++) {
+		tool->audio[0][s] = (int16_t)(((s * 37) % 2000) * 8 - 8000);
+		tool->audio[1][s] = (int16_t)(((s * 53) % 3000) * 6 - 9000);
+	}
+
+	return 0;
+}
+
+static void usage(const char *program)
+{
+	printf("Version: %s\n", GIT_VERSION);
+	printf("Measure the cache traffic of concurrent audio and video pushes with the cpu performance counters.\n");
+	printf("Usage: %s\n", program);
+	printf("  -c number of contexts, allocated side by side (def: 2)\n");
+	printf("  -n number of frames (def: 300)\n");
+	printf("  -H pixel height (def: 720)\n");
+	printf("  -W pixel width (def: 1280)\n");
+	printf("  -v increase level of verbosity\n");
+	printf("\n");
+	printf("  Eg. %s -c 4 -n 600\n\n", program);
+}
+
+int main(int argc, char *argv[])
+{
+	struct tool_ctx_s tool = { 0 };
+	tool.width = 1280;
+	tool.height = 720;
+	tool.frames = 300;
+	tool.contexts = 2;
+
+	int ch;
+
+	while ((ch = getopt(argc, argv, "?hc:n:vH:W:")) != -1) {
+		switch (ch) {
+		case 'c':
+			tool.contexts = atoi(optarg);
+			break;
+		case 'n':
+			tool.frames = atoi(optarg);
+			break;
+		case 'H':
+			tool.height = atoi(optarg);
+			break;
+		case 'W':
+			tool.width = atoi(optarg);
+			break;
+		case 'v':
+			tool.verbose++;
+			break;
+		case '?':
+		case 'h':
+		default:
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	if (tool.contexts == 0 || tool.frames == 0 || tool.width == 0 || tool.height == 0) {
+		usage(argv[0]);
+		exit(1);
+	}
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus < 2) {
+		printf("Skipping, cross core traffic needs at least two cpus, %ld online.\n", cpus);
+		return 0;
+	}
+	tool.cpus = cpus;
+
+	/* Probe the counters up front, PMU access is often missing or restricted */
+	struct thread_s probe = { 0 };
+	int ret = perf_begin(&probe);
+	if (ret < 0) {
+		printf("Skipping, performance counters unavailable (%s), see /proc/sys/kernel/perf_event_paranoid.\n",
+			strerror(-ret));
+		return 0;
+	}
+	perf_end(&probe);
+
+	if (synthesise(&tool) < 0) {
+		fprintf(stderr, "Unable to allocate the frames\n");
+		return -1;
+	}
+
+	void **hdls = calloc(tool.contexts, sizeof(void *));
+	struct thread_s *threads = calloc(tool.contexts * 2, sizeof(*threads));
+	if (!hdls || !threads) {
+		return -1;
+	}
+
+	uint64_t serial[COUNTER_COUNT];
+	uint64_t concurrent[COUNTER_COUNT];
+
+	/* Serial, one thread does everything */
+	if (alloc_contexts(&tool, hdls) < 0) {
+		fprintf(stderr, "Unable to allocate a context\n");
+		return -1;
+	}
+	memset(serial, 0, sizeof(serial));
+	for (uint32_t i = 0; i < tool.contexts; i++) {
+		uint64_t values[COUNTER_COUNT];
+		struct thread_s *t = &threads[0];
+		memset(t, 0, sizeof(*t));
+		t->tool = &tool;
+		t->hdl = hdls[i];
+		t->both = 1;
+		t->cpu = 0;
+		ret = run(t, 1, values);
+		if (ret < 0) {
+			break;
+		}
+		for (uint32_t k = 0; k < COUNTER_COUNT; k++) {
+			serial[k] += values[k];
+		}
+	}
+	free_contexts(&tool, hdls);
+
+	/* Concurrent, a video and an audio thread per context, spread over the cpus */
+	if (ret == 0) {
+		if (alloc_contexts(&tool, hdls) < 0) {
+			fprintf(stderr, "Unable to allocate a context\n");
+			return -1;
+		}
+		for (uint32_t i = 0; i < tool.contexts * 2; i++) {
+			struct thread_s *t = &threads[i];
+			memset(t, 0, sizeof(*t));
+			t->tool = &tool;
+			t->hdl = hdls[i / 2];
+			t->video = (i & 1) == 0;
+			t->cpu = i % tool.cpus;
+		}
+		ret = run(threads, tool.contexts * 2, concurrent);
+		free_contexts(&tool, hdls);
+	}
+
+	if (ret < 0) {
+		fprintf(stderr, "Run failed, %s\n", strerror(-ret));
+		return -1;
+	}
+
+	uint64_t frames = (uint64_t)tool.frames * tool.contexts;
+	printf("%u context(s), %u frames each, %ux%u, %u cpus\n",
+		tool.contexts, tool.frames, tool.width, tool.height, tool.cpus);
+	printf("%-14s %14s %14s %14s\n", "per frame", "serial", "concurrent", "cross core");
+	for (uint32_t k = 0; k < COUNTER_COUNT; k++) {
+		double s = (double)serial[k] / frames;
+		double c = (double)concurrent[k] / frames;
+		printf("%-14s %14.1f %14.1f %14.1f\n", counters[k].name, s, c, c - s);
+	}
+
+	free(threads);
+	free(hdls);
+	free(tool.luma);
+	free(tool.audio[0]);
+	free(tool.audio[1]);
+
+	return 0;
+}
@@ -30,6 +30,7 @@ static void usage(const char *program)
 	printf("  -Y audioS32le.bin filename (interleaved only L / R / L / R)\n");
 	printf("  -H pixel height\n");
 	printf("  -W pixel width\n");
+	printf("  -X input is interlaced, field 1 on even lines (def: progressive)\n");
 	printf("  -v increase level of verbosity\n");
 	printf("\n");
 	printf("  Eg. %s -i ../../dwts-master2880.yuv -W 1280 -H 720 -I ../../audio-ch2-s32-soccer.bin [-v]\n\n", program);
@@ -46,7 +47,7 @@ int main(int argc, char *argv[])
 
 	int ch;
 
-	while ((ch = getopt(argc, argv, "?hi:vB:H:I:S:W:Y:")) != -1) {
+	while ((ch = getopt(argc, argv, "?hi:vB:H:I:S:W:XY:")) != -1) {
 		switch (ch) {
 		case 'i':
 			if (ctx->ivname) {
@@ -82,6 +83,9 @@ int main(int argc, char *argv[])
 			ctx->width = atoi(optarg);
 			ctx->stride = ctx->width;
 			break;
+		case 'X':
+			ctx->progressive = 0;
+			break;
 		default:
 			usage(argv[0]);
 			exit(1);
@@ -142,7 +146,7 @@ int main(int argc, char *argv[])
 	/* */
 	if (klsmpte2064_context_alloc(&ctx->hdl,
 		COLORSPACE_YUV420P,
-		1, // uint32_t progressive,
+		ctx->progressive, // uint32_t progressive,
 		ctx->width, // uint32_t width,
 		ctx->height, // uint32_t height,
 		ctx->stride, // uint32_t stride,